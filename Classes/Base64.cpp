@@ -8,65 +8,238 @@
 
 #include "Base64.h"
 #include "util.hpp"
+#include "Var.hpp"
 
+#include <algorithm>
 #include <cctype>
+#include <cstring>
 #include <stdexcept>
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define BASE64_SIMD_X86
+#define BASE64_SSSE3 __attribute__((target("ssse3")))
+#define BASE64_AVX2 __attribute__((target("avx2")))
+#endif
 
 
 
 namespace {
+    using std::size_t;
     using std::string;
     using base64::UINT32;
 
 
     char const CR_LF[] = {'\r', '\n'};
-    bool const k_isBigEndian = util::IsBigEndian();
 
 
-    union UHigh3Bytes
+    //编码全部完整的 3 字节组，返回已编码的字节数
+    size_t encodeScalar(char const * table, unsigned char const * in, size_t n, char * out)
     {
-        typedef string::value_type BYTE;
+        size_t i = 0;
+        for( ; i + 3 <= n; i += 3, out += 4 ) {
+            UINT32 v = UINT32(in[i]) << 16 | UINT32(in[i+1]) << 8 | in[i+2];
+            out[0] = table[v >> 18];
+            out[1] = table[v >> 12 & 63];
+            out[2] = table[v >> 6 & 63];
+            out[3] = table[v & 63];
+        }
+        return i;
+    }
 
-        UINT32 all;
-        BYTE bytes[4];
+    //解码连续的、不含空白与填充的 4 字符组，遇到其他字符即停止；返回已解码的字符数
+    size_t decodeScalar(char const * table, unsigned char const * in, size_t n, char * out)
+    {
+        size_t i = 0;
+        for( ; i + 4 <= n; i += 4, out += 3 ) {
+            UINT32 a = (unsigned char)table[in[i]], b = (unsigned char)table[in[i+1]],
+                   c = (unsigned char)table[in[i+2]], d = (unsigned char)table[in[i+3]];
+            if((a | b | c | d) & 0xC0) {
+                break;
+            }
+            UINT32 v = a << 18 | b << 12 | c << 6 | d;
+            out[0] = char(v >> 16);
+            out[1] = char(v >> 8);
+            out[2] = char(v);
+        }
+        return i;
+    }
 
-        UHigh3Bytes()
-            : all(0)
-        {
+#ifdef BASE64_SIMD_X86
+    //按 6 位下标分类后查偏移表：0..25 为 13，26..51 为 0，52..61 为 1..10，62、63 为 11、12
+    BASE64_SSSE3 size_t ssse3Encode(char c62, char c63, unsigned char const * in, size_t n, char * out)
+    {
+        __m128i const shuf = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+        __m128i const lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, char(c62 - 62), char(c63 - 63), 'A', 0, 0);
+        size_t i = 0;
+        for( ; i + 16 <= n; i += 12, out += 16 ) {
+            auto v = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const*)(in + i)), shuf);
+            auto hi = _mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+            auto lo = _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+            auto idx = _mm_or_si128(hi, lo);
+            auto cls = _mm_or_si128(_mm_subs_epu8(idx, _mm_set1_epi8(51)),
+                                    _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), idx), _mm_set1_epi8(13)));
+            _mm_storeu_si128((__m128i*)out, _mm_add_epi8(idx, _mm_shuffle_epi8(lut, cls)));
         }
+        return i;
+    }
 
-        void init(BYTE high, BYTE middle, BYTE low)
-        {
-            if(k_isBigEndian) {
-                bytes[0] = high;
-                bytes[1] = middle;
-                bytes[2] = low;
-                bytes[3] = 0;
+    BASE64_AVX2 size_t avx2Encode(char c62, char c63, unsigned char const * in, size_t n, char * out)
+    {
+        __m256i const shuf = _mm256_broadcastsi128_si256(_mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+        __m256i const lut = _mm256_broadcastsi128_si256(_mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, char(c62 - 62), char(c63 - 63), 'A', 0, 0));
+        size_t i = 0;
+        for( ; i + 28 <= n; i += 24, out += 32 ) {
+            auto v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((__m128i const*)(in + i))),
+                                             _mm_loadu_si128((__m128i const*)(in + i + 12)), 1);
+            v = _mm256_shuffle_epi8(v, shuf);
+            auto hi = _mm256_mulhi_epu16(_mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+            auto lo = _mm256_mullo_epi16(_mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+            auto idx = _mm256_or_si256(hi, lo);
+            auto cls = _mm256_or_si256(_mm256_subs_epu8(idx, _mm256_set1_epi8(51)),
+                                       _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx), _mm256_set1_epi8(13)));
+            _mm256_storeu_si256((__m256i*)out, _mm256_add_epi8(idx, _mm256_shuffle_epi8(lut, cls)));
+        }
+        return i;
+    }
+
+    //按范围分类字母与数字，c62、c63 逐字节比较；块内有其他字符时停止。
+    //下一块仍在输入内时整块写出（多写的 4 字节由下一块覆盖），否则只写 12 字节
+    BASE64_SSSE3 size_t ssse3Decode(char c62, char c63, unsigned char const * in, size_t n, char * out)
+    {
+        size_t i = 0;
+        for( ; i + 16 <= n; i += 16, out += 12 ) {
+            auto v = _mm_loadu_si128((__m128i const*)(in + i));
+            auto upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+            auto lower = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('z' + 1)));
+            auto digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+            auto is62 = _mm_cmpeq_epi8(v, _mm_set1_epi8(c62));
+            auto is63 = _mm_cmpeq_epi8(v, _mm_set1_epi8(c63));
+            auto valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, _mm_or_si128(is62, is63)));
+            if(_mm_movemask_epi8(valid) != 0xFFFF) {
+                break;
+            }
+            auto off = _mm_or_si128(_mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')), _mm_and_si128(lower, _mm_set1_epi8(26 - 'a'))),
+                                    _mm_or_si128(_mm_and_si128(digit, _mm_set1_epi8(52 - '0')),
+                                                 _mm_or_si128(_mm_and_si128(is62, _mm_set1_epi8(char(62 - c62))),
+                                                              _mm_and_si128(is63, _mm_set1_epi8(char(63 - c63))))));
+            auto merged = _mm_maddubs_epi16(_mm_add_epi8(v, off), _mm_set1_epi32(0x01400140));
+            auto packed = _mm_shuffle_epi8(_mm_madd_epi16(merged, _mm_set1_epi32(0x00011000)),
+                                           _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+            if(i + 32 <= n) {
+                _mm_storeu_si128((__m128i*)out, packed);
             }
             else {
-                bytes[3] = high;
-                bytes[2] = middle;
-                bytes[1] = low;
-                bytes[0] = 0;
+                char buf[16];
+                _mm_storeu_si128((__m128i*)buf, packed);
+                std::memcpy(out, buf, 12);
             }
         }
+        return i;
+    }
 
-        string toString()const
-        {
-            string rtn(3, '\0');
-            if(k_isBigEndian) {
-                rtn[0] = bytes[0];
-                rtn[1] = bytes[1];
-                rtn[2] = bytes[2];
+    BASE64_AVX2 size_t avx2Decode(char c62, char c63, unsigned char const * in, size_t n, char * out)
+    {
+        size_t i = 0;
+        for( ; i + 32 <= n; i += 32, out += 24 ) {
+            auto v = _mm256_loadu_si256((__m256i const*)(in + i));
+            auto upper = _mm256_andnot_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('Z')), _mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)));
+            auto lower = _mm256_andnot_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('z')), _mm256_cmpgt_epi8(v, _mm256_set1_epi8('a' - 1)));
+            auto digit = _mm256_andnot_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('9')), _mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)));
+            auto is62 = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c62));
+            auto is63 = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c63));
+            auto valid = _mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(digit, _mm256_or_si256(is62, is63)));
+            if(_mm256_movemask_epi8(valid) != -1) {
+                break;
+            }
+            auto off = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(upper, _mm256_set1_epi8(-'A')), _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a'))),
+                                       _mm256_or_si256(_mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')),
+                                                       _mm256_or_si256(_mm256_and_si256(is62, _mm256_set1_epi8(char(62 - c62))),
+                                                                       _mm256_and_si256(is63, _mm256_set1_epi8(char(63 - c63))))));
+            auto merged = _mm256_maddubs_epi16(_mm256_add_epi8(v, off), _mm256_set1_epi32(0x01400140));
+            auto packed = _mm256_shuffle_epi8(_mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000)),
+                                              _mm256_broadcastsi128_si256(_mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)));
+            packed = _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+            if(i + 64 <= n) {
+                _mm256_storeu_si256((__m256i*)out, packed);
             }
             else {
-                rtn[0] = bytes[3];
-                rtn[1] = bytes[2];
-                rtn[2] = bytes[1];
+                char buf[32];
+                _mm256_storeu_si256((__m256i*)buf, packed);
+                std::memcpy(out, buf, 24);
+            }
+        }
+        return i;
+    }
+#endif
+
+    //table 为编码表
+    size_t encodeBlocks(char const * table, unsigned char const * in, size_t n, char * out)
+    {
+        size_t i = 0;
+#ifdef BASE64_SIMD_X86
+        if(util::HasAVX2()) {
+            i = avx2Encode(table[62], table[63], in, n, out);
+        }
+        if(util::HasSSSE3()) {
+            i += ssse3Encode(table[62], table[63], in + i, n - i, out + i / 3 * 4);
+        }
+#endif
+        return i + encodeScalar(table, in + i, n - i, out + i / 3 * 4);
+    }
+
+    //table 为解码表；simd 为假时字母表与范围分类不符，只用查表
+    size_t decodeBlocks(char const * table, bool simd, char c62, char c63, unsigned char const * in, size_t n, char * out)
+    {
+        size_t i = 0;
+#ifdef BASE64_SIMD_X86
+        if(simd && util::HasAVX2()) {
+            i = avx2Decode(c62, c63, in, n, out);
+        }
+        if(simd && util::HasSSSE3()) {
+            i += ssse3Decode(c62, c63, in + i, n - i, out + i / 4 * 3);
+        }
+#else
+        (void)simd, (void)c62, (void)c63;
+#endif
+        return i + decodeScalar(table, in + i, n - i, out + i / 4 * 3);
+    }
+
+    //已编码的字符按行写出：一行满 lineMax 个字符后、下一个字符之前加 CR LF
+    char * putWrapped(char * out, char const * chars, size_t n, size_t lineMax, size_t & lineLength)
+    {
+        if(!lineMax) {
+            std::memcpy(out, chars, n);
+            return out + n;
+        }
+        while(n) {
+            if(lineLength == lineMax) {
+                std::memcpy(out, CR_LF, sizeof(CR_LF));
+                out += sizeof(CR_LF);
+                lineLength = 0;
             }
-            return rtn;
+            auto k = std::min(n, lineMax - lineLength);
+            std::memcpy(out, chars, k);
+            out += k;
+            chars += k;
+            n -= k;
+            lineLength += k;
         }
-    };
+        return out;
+    }
+
+    inline
+    bool isAlnum(char ch)
+    {
+        return std::isalnum((unsigned char)ch) && (unsigned char)ch < 0x80;
+    }
+
+    inline
+    bool isSpace(char ch)
+    {
+        return std::isspace((unsigned char)ch) != 0;
+    }
 }
 
 
@@ -84,6 +257,12 @@ namespace base64 {
         return std::runtime_error("base64 - Decoding a corrupted string.");
     }
 
+    inline
+    std::logic_error WrongCoder()
+    {
+        return std::logic_error("base64 - Encoding with a decoder or decoding with an encoder.");
+    }
+
 
     string const Coder::FIRST_62_CHARS = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
 
@@ -111,6 +290,43 @@ namespace base64 {
         }
     }
 
+    Var Coder::code(Var const & in)const
+    {
+        auto & v = in.force();
+        !v;
+        char const * p;
+        size_t n;
+        switch(v.type) {
+            case Var::Type::string:
+                p = v.s->data();
+                n = v.s->size();
+                break;
+            case Var::Type::bytes:
+            case Var::Type::strview:
+                p = v.y->data;
+                n = v.y->size;
+                break;
+            default:
+                throw Var::TypeError(v.type, __FUNCTION__);
+        }
+
+        //按上限分配 bytes 的缓冲区，直接编解码进去，再截到实际长度
+        string buf;
+        switch(m_table.size()) {
+            case ENCODE_TABLE_SIZE:
+                buf.resize(encodedSize(n));
+                buf.resize(encodeTo(p, n, &buf[0]));
+                break;
+            case DECODE_TABLE_SIZE:
+                buf.resize(maxDecodedSize(n));
+                buf.resize(decodeTo(p, n, &buf[0]));
+                break;
+            default:
+                throw BadCoder();
+        }
+        return Var::bytes(std::move(buf));
+    }
+
     char Coder::the63rdChar()const
     {
         switch(m_table.size()) {
@@ -226,7 +442,7 @@ namespace base64 {
         m_table.swap(table);
     }
 
-    string Coder::encodeBuffer(char const * bytes, size_t nByte)const
+    size_t Coder::encodedSize(size_t nByte)const
     {
         auto endingSize = nByte % 3;
         if(endingSize) {
@@ -234,88 +450,166 @@ namespace base64 {
             //Add pad size:
             auto nPad = m_szPad[0] ? 4-endingSize : 0;
             (nPad)&&
-                (endingSize += nPad * pad().length());
+                (endingSize += nPad * std::strlen(m_szPad));
         }
 
         auto resultSize = nByte/3*4 + endingSize;
         size_t const k_lineMax = lineLengthMax();
-        if(k_lineMax) {
+        if(k_lineMax && resultSize) {
             //Add CR_LF size:
-            auto nCR_LF = resultSize / k_lineMax;
-            (resultSize % k_lineMax)||
-                --nCR_LF;
-            resultSize += nCR_LF * sizeof(CR_LF);
+            resultSize += (resultSize - 1) / k_lineMax * sizeof(CR_LF);
         }
+        return resultSize;
+    }
 
-        string rtn;
-        rtn.reserve(resultSize);
-
-        for( size_t lineLength = 0; nByte; ) {
-            //Encode 3 bytes:
-            if(nByte >= 3) {
-                rtn += encode3Bytes(bytes, 3);
-                lineLength += 4;
-                bytes += 3;
-                nByte -= 3;
-            }
-            else {
-                rtn += encode3Bytes(bytes, nByte);
-                lineLength += endingSize;
-                nByte = 0;
-            }
-            //New line:
-            if(k_lineMax && lineLength > k_lineMax) {
-                lineLength -= k_lineMax;
-                rtn.insert(rtn.length()-lineLength, CR_LF, sizeof(CR_LF));
-            }
+    size_t Coder::maxDecodedSize(size_t nChar)const
+    {
+        return (nChar + 3) / 4 * 3;
+    }
+
+    void Coder::mustBe(unsigned tableSize)const
+    {
+        if(m_table.size() != tableSize) {
+            throw WrongCoder();
         }
-        if(rtn.size() != resultSize) {
+    }
+
+    size_t Coder::encodeTo(void const * p, size_t nByte, char * out)const
+    {
+        mustBe(ENCODE_TABLE_SIZE);
+        size_t lineLength = 0;
+        return encodeChunk((unsigned char const*)p, nByte, true, out, lineLength);
+    }
+
+    size_t Coder::decodeTo(void const * p, size_t nChar, char * out)const
+    {
+        mustBe(DECODE_TABLE_SIZE);
+        auto bytes = (unsigned char const*)p;
+        return decodeChunk(bytes, nChar, out, maxDecodedSize(nChar));
+    }
+
+    string Coder::encodeBuffer(char const * bytes, size_t nByte)const
+    {
+        string rtn(encodedSize(nByte), '\0');
+        size_t lineLength = 0;
+        if(encodeChunk((unsigned char const*)bytes, nByte, true, &rtn[0], lineLength) != rtn.size()) {
             throw std::logic_error("base64 - Wrong encoder algorithm.");
         }
         return rtn;
     }
 
-    string Coder::encode3Bytes(char const * bytes, size_t nByte)const
+    size_t Coder::encodeChunk(unsigned char const * bytes, size_t nByte, bool last, char * out, size_t & lineLength)const
     {
-        UHigh3Bytes tribyte;
-        tribyte.init(bytes[0], nByte>1?bytes[1]:0, nByte>2?bytes[2]:0);
-        auto nPad = m_szPad[0] ? 3-nByte : 0;
-        string rtn;
-        rtn.reserve(12);
-
-        for( ++nByte; nByte; --nByte ) {
-            //Encode 6 bits:
-            rtn.push_back(m_table[tribyte.all >> 26]);
-            tribyte.all <<= 6;
+        auto begin = out;
+        auto table = m_table.data();
+        size_t const k_lineMax = lineLengthMax();
+        if(!k_lineMax) {
+            auto done = encodeBlocks(table, bytes, nByte, out);
+            out += done / 3 * 4;
+            bytes += done;
+            nByte -= done;
         }
-        for( ; nPad; --nPad ) {
-            rtn += m_szPad;
+        else if(k_lineMax % 4 == 0 && lineLength % 4 == 0) {
+            //Whole groups per line, encoded in place:
+            while(nByte >= 3) {
+                if(lineLength == k_lineMax) {
+                    std::memcpy(out, CR_LF, sizeof(CR_LF));
+                    out += sizeof(CR_LF);
+                    lineLength = 0;
+                }
+                auto done = encodeBlocks(table, bytes, std::min(nByte / 3, (k_lineMax - lineLength) / 4) * 3, out);
+                out += done / 3 * 4;
+                lineLength += done / 3 * 4;
+                bytes += done;
+                nByte -= done;
+            }
         }
-        return rtn;
+        else {
+            char buf[1024];
+            while(nByte >= 3) {
+                auto done = encodeBlocks(table, bytes, std::min(nByte, sizeof(buf) / 4 * 3), buf);
+                out = putWrapped(out, buf, done / 3 * 4, k_lineMax, lineLength);
+                bytes += done;
+                nByte -= done;
+            }
+        }
+        if(nByte && last) {
+            char buf[16];
+            out = putWrapped(out, buf, encodeEnding(bytes, nByte, buf), k_lineMax, lineLength);
+        }
+        return out - begin;
     }
 
-    string Coder::decodeString(unsigned char const * bytes, size_t nByte)const
+    size_t Coder::decodeChunk(unsigned char const* & bytes, size_t & nByte, char * out, size_t capacity)const
     {
-        string rtn;
-        rtn.reserve(nByte * 3 / 4);
+        char c62, c63;
+        bool simd;
+        bool fast = fastDecoding(c62, c63, simd);
+
+        size_t n = 0;
+        while(nByte && capacity - n >= 3) {
+            if(fast) {
+                //Limit input so that vector stores stay in capacity:
+                auto limit = std::min(nByte, (capacity - n) / 3 * 4);
+                auto done = decodeBlocks(m_table.data(), simd, c62, c63, bytes, limit, out + n);
+                bytes += done;
+                nByte -= done;
+                n += done / 4 * 3;
+            }
+            if(nByte && capacity - n >= 3) {
+                n += decode4Chars(bytes, nByte, out + n);
+            }
+        }
+        return n;
+    }
+
+    size_t Coder::encodeEnding(unsigned char const * bytes, size_t nByte, char * out)const
+    {
+        auto begin = out;
+        UINT32 v = UINT32(bytes[0]) << 16 | (nByte > 1 ? UINT32(bytes[1]) << 8 : 0);
+        *out++ = m_table[v >> 18];
+        *out++ = m_table[v >> 12 & 63];
+        if(nByte > 1) {
+            *out++ = m_table[v >> 6 & 63];
+        }
+        for( auto nPad = m_szPad[0] ? 3 - nByte : 0; nPad; --nPad ) {
+            for( auto p = m_szPad; *p; ) {
+                *out++ = *p++;
+            }
+        }
+        return out - begin;
+    }
 
-        for( ; nByte; rtn += decode4Chars(bytes, nByte) );
+    bool Coder::fastDecoding(char & c62, char & c63, bool & simd)const
+    {
+        //Fast path only when pad and whitespace cannot be taken for table chars:
+        c62 = the63rdChar();
+        c63 = the64thChar();
+        bool fast = !isSpace(c62) && !isSpace(c63)
+            && (!m_szPad[0] || m_table[(unsigned char)m_szPad[0]] == DECODE_UNKNOWN);
+        simd = fast && c62 != c63 && !isAlnum(c62) && !isAlnum(c63);
+        return fast;
+    }
 
+    string Coder::decodeString(unsigned char const * bytes, size_t nByte)const
+    {
+        string rtn(maxDecodedSize(nByte), '\0');
+        rtn.resize(decodeChunk(bytes, nByte, &rtn[0], rtn.size()));
         return rtn;
     }
 
-    string Coder::decode4Chars(unsigned char const* & bytes, size_t & nByte)const
+    size_t Coder::decode4Chars(unsigned char const* & bytes, size_t & nByte, char * out)const
     {
         unsigned char ch, nCh = 0;
-        UHigh3Bytes tribyte;
+        UINT32 tribyte = 0;
 
         for( int i = 0; i != 4; ++i ) {
             //Skip white space:
-            for( ; std::isspace(*bytes); ++bytes ) {
-                nByte && --nByte;
+            for( ; nByte && std::isspace(*bytes); ++bytes ) {
+                --nByte;
             }
             if(!nByte) {
-                tribyte.all <<= 6;
+                tribyte <<= 6;
                 continue;
             }
             //Get char:
@@ -323,19 +617,19 @@ namespace base64 {
             --nByte;
             if(ch == m_szPad[0]) {
                 for( int j = 1; m_szPad[j]; ++j ) {
-                    if(*bytes == m_szPad[j]) {
+                    if(nByte && *bytes == m_szPad[j]) {
                         ++bytes;
                         nByte && --nByte;
                     }
                 }
-                tribyte.all <<= 6;
+                tribyte <<= 6;
                 continue;
             }
             //Decode char:
             ch = m_table[ch];
             if(ch != (unsigned char)DECODE_UNKNOWN) {
-                tribyte.all <<= 6;
-                tribyte.all |= ch;
+                tribyte <<= 6;
+                tribyte |= ch;
                 ++nCh;
             }
             else if(onlyDecodeKnownChars()) {
@@ -345,12 +639,156 @@ namespace base64 {
                 --i;
             }
         }
-        tribyte.all <<= 8;
         if(nCh == 1) {
             throw BadBase64String();
         }
-        return (nCh)?
-            tribyte.toString().substr(0, --nCh):
-            string();
+        size_t n = nCh ? nCh - 1 : 0;
+        for( size_t i = 0; i != n; ++i ) {
+            out[i] = char(tribyte >> (16 - 8*i));
+        }
+        return n;
+    }
+
+
+    Stream::Stream(Coder const & coder)
+        : m_coder(coder)
+    {
+        switch(m_coder.m_table.size()) {
+            case Coder::ENCODE_TABLE_SIZE:
+                break;
+            case Coder::DECODE_TABLE_SIZE:
+                m_fast = m_coder.fastDecoding(m_c62, m_c63, m_simd);
+                break;
+            default:
+                throw BadCoder();
+        }
+    }
+
+    string Stream::update(void const * p, size_t nByte)
+    {
+        return m_coder.m_table.size() == Coder::ENCODE_TABLE_SIZE ?
+            encode((unsigned char const*)p, nByte):
+            decode((unsigned char const*)p, nByte);
+    }
+
+    string Stream::finish()
+    {
+        string rtn;
+        if(m_coder.m_table.size() == Coder::ENCODE_TABLE_SIZE) {
+            if(m_nRest) {
+                char buf[16];
+                auto n = m_coder.encodeEnding(m_rest, m_nRest, buf);
+                rtn.resize(n + n * sizeof(CR_LF));
+                rtn.resize(putWrapped(&rtn[0], buf, n, m_coder.lineLengthMax(), m_lineLength) - &rtn[0]);
+            }
+        }
+        else if(m_nSlot) {
+            //Missing chars count as zero bits:
+            rtn.resize(3);
+            rtn.resize(endGroup(m_bits << 6 * (4 - m_nSlot), &rtn[0]));
+        }
+        m_nRest = 0;
+        m_lineLength = 0;
+        m_bits = 0;
+        m_nSlot = m_nCh = m_iPad = 0;
+        return rtn;
+    }
+
+    string Stream::encode(unsigned char const * bytes, size_t nByte)
+    {
+        size_t const k_lineMax = m_coder.lineLengthMax();
+        auto nChar = (m_nRest + nByte) / 3 * 4;
+        string rtn(nChar + (k_lineMax ? (nChar / k_lineMax + 1) * sizeof(CR_LF) : 0), '\0');
+        auto out = &rtn[0];
+        char buf[4];
+
+        //Complete the rest bytes of last update:
+        for( ; m_nRest && m_nRest < 3 && nByte; --nByte ) {
+            m_rest[m_nRest++] = *bytes++;
+        }
+        if(m_nRest == 3) {
+            encodeScalar(m_coder.m_table.data(), m_rest, 3, buf);
+            out = putWrapped(out, buf, 4, k_lineMax, m_lineLength);
+            m_nRest = 0;
+        }
+        auto nBlock = nByte / 3 * 3;
+        out += m_coder.encodeChunk(bytes, nBlock, false, out, m_lineLength);
+        bytes += nBlock;
+        nByte -= nBlock;
+        for( ; nByte; --nByte ) {
+            m_rest[m_nRest++] = *bytes++;
+        }
+        rtn.resize(out - &rtn[0]);
+        return rtn;
+    }
+
+    //与 Coder::decode4Chars 逐字符等价：组内的位、已得的字符数与填充的续接跨块保存
+    string Stream::decode(unsigned char const * bytes, size_t nByte)
+    {
+        string rtn((nByte + 3) / 4 * 3 + 3, '\0');
+        auto out = &rtn[0];
+        auto const & table = m_coder.m_table;
+        auto const & pad = m_coder.m_szPad;
+
+        while(nByte) {
+            if(m_fast && !m_nSlot && !m_iPad) {
+                auto done = decodeBlocks(table.data(), m_simd, m_c62, m_c63, bytes, nByte, out);
+                bytes += done;
+                nByte -= done;
+                out += done / 4 * 3;
+                if(!nByte) {
+                    break;
+                }
+            }
+            unsigned char ch = *bytes++;
+            --nByte;
+            //Rest chars of pad:
+            if(m_iPad) {
+                while(pad[m_iPad] && ch != (unsigned char)pad[m_iPad]) {
+                    ++m_iPad;
+                }
+                if(pad[m_iPad]) {
+                    pad[++m_iPad] || (m_iPad = 0);
+                    continue;
+                }
+                m_iPad = 0;
+            }
+            if(std::isspace(ch)) {
+                continue;
+            }
+            if(ch == (unsigned char)pad[0]) {
+                m_bits <<= 6;
+                m_iPad = pad[1] ? 1 : 0;
+            }
+            else if(table[ch] != Coder::DECODE_UNKNOWN) {
+                m_bits = m_bits << 6 | (unsigned char)table[ch];
+                ++m_nCh;
+            }
+            else if(m_coder.onlyDecodeKnownChars()) {
+                throw BadBase64String();
+            }
+            else {
+                continue;
+            }
+            if(++m_nSlot == 4) {
+                out += endGroup(m_bits, out);
+            }
+        }
+        rtn.resize(out - &rtn[0]);
+        return rtn;
+    }
+
+    size_t Stream::endGroup(UINT32 bits, char * out)
+    {
+        if(m_nCh == 1) {
+            throw BadBase64String();
+        }
+        size_t n = m_nCh ? m_nCh - 1 : 0;
+        for( size_t i = 0; i != n; ++i ) {
+            out[i] = char(bits >> (16 - 8*i));
+        }
+        m_bits = 0;
+        m_nSlot = m_nCh = 0;
+        return n;
     }
 }
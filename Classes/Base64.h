@@ -10,8 +10,13 @@
 #define __BASE64__H__
 
 
+#include <algorithm>
 #include <cstddef>
 #include <string>
+struct SharedPolicy;
+template<typename Policy>
+class BasicVar;
+using Var = BasicVar<SharedPolicy>;
 
 
 namespace base64 {
@@ -29,10 +34,23 @@ namespace base64 {
         friend Coder Decoder();
         friend Coder * newEncoder();
         friend Coder * newDecoder();
+        friend class Stream;
 
     public:
         void toContraryCoder();
         string code(void const * p, size_t nByte)const;
+        Var    code(Var const & in)const;
+
+        //不分配内存的接口：out 须能容纳 encodedSize(nByte) 或 maxDecodedSize(nChar) 个字节，返回写入的字节数
+        size_t encodedSize(size_t nByte)const;
+        size_t maxDecodedSize(size_t nChar)const;
+        size_t encodeTo(void const * p, size_t nByte, char * out)const;
+        size_t decodeTo(void const * p, size_t nChar, char * out)const;
+        //写到输出迭代器，经栈上的缓冲区分段
+        template<typename OutputIt>
+        size_t encodeTo(void const * p, size_t nByte, OutputIt out)const;
+        template<typename OutputIt>
+        size_t decodeTo(void const * p, size_t nChar, OutputIt out)const;
 
         char the63rdChar()const;
         void the63rdChar(char value);
@@ -59,10 +77,47 @@ namespace base64 {
               string const & pad = "=", int lineMax = 64, bool only64Chars = true);
         void initEncodeTable(char ch63rd, char ch64th);
         void initDecodeTable(unsigned char ch63rd, unsigned char ch64th);
+        static size_t const CHUNK_SIZE = 768;
+
+        void mustBe(unsigned tableSize)const;
         string encodeBuffer(char const * bytes, size_t nByte)const;
-        string encode3Bytes(char const * bytes, size_t nByte)const;
+        size_t encodeChunk(unsigned char const * bytes, size_t nByte, bool last, char * out, size_t & lineLength)const;
         string decodeString(unsigned char const * bytes, size_t nByte)const;
-        string decode4Chars(unsigned char const* & bytes, size_t & nByte)const;
+        size_t decodeChunk(unsigned char const* & bytes, size_t & nByte, char * out, size_t capacity)const;
+        size_t decode4Chars(unsigned char const* & bytes, size_t & nByte, char * out)const;
+        size_t encodeEnding(unsigned char const * bytes, size_t nByte, char * out)const;
+        bool fastDecoding(char & c62, char & c63, bool & simd)const;
+    };
+
+
+    //流式编解码：输入可分块传给 update，最后调用 finish 写出结尾的字节与填充，之后可重新使用。
+    //结果与把各块连起来一次 code 相同；余下的字节、换行位置与跨块的填充、空白都保存在对象内
+    class Stream
+    {
+    public:
+        explicit Stream(Coder const & coder);
+        string update(void const * p, size_t nByte);
+        string finish();
+
+    private:
+        Coder m_coder;
+        //Encoding:
+        unsigned char m_rest[3];
+        size_t m_nRest = 0;
+        size_t m_lineLength = 0;
+        //Decoding:
+        UINT32 m_bits = 0;
+        int m_nSlot = 0;
+        int m_nCh = 0;
+        int m_iPad = 0;
+        bool m_fast = false;
+        bool m_simd = false;
+        char m_c62 = 0;
+        char m_c63 = 0;
+
+        string encode(unsigned char const * bytes, size_t nByte);
+        string decode(unsigned char const * bytes, size_t nByte);
+        size_t endGroup(UINT32 bits, char * out);
     };
 
 
@@ -92,6 +147,40 @@ namespace base64 {
         return new Coder(Coder::DECODE_TABLE_SIZE);
     }
 
+    template<typename OutputIt>
+    size_t Coder::encodeTo(void const * p, size_t nByte, OutputIt out)const
+    {
+        //A chunk of bytes with ending and pads, at most one CR_LF per char:
+        char buf[(CHUNK_SIZE / 3 * 4 + 12) * 3];
+        mustBe(ENCODE_TABLE_SIZE);
+        auto bytes = (unsigned char const*)p;
+        size_t lineLength = 0, rtn = 0;
+        do {
+            auto n = std::min(nByte, size_t(CHUNK_SIZE));
+            auto k = encodeChunk(bytes, n, n == nByte, buf, lineLength);
+            out = std::copy(buf, buf + k, out);
+            rtn += k;
+            bytes += n;
+            nByte -= n;
+        } while(nByte);
+        return rtn;
+    }
+
+    template<typename OutputIt>
+    size_t Coder::decodeTo(void const * p, size_t nChar, OutputIt out)const
+    {
+        char buf[CHUNK_SIZE];
+        mustBe(DECODE_TABLE_SIZE);
+        auto bytes = (unsigned char const*)p;
+        size_t rtn = 0;
+        while(nChar) {
+            auto k = decodeChunk(bytes, nChar, buf, sizeof(buf));
+            out = std::copy(buf, buf + k, out);
+            rtn += k;
+        }
+        return rtn;
+    }
+
     inline
     string Coder::pad()const
     {
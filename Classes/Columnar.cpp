@@ -0,0 +1,283 @@
+﻿#include "Columnar.hpp"
+#include <cmath>
+#include <limits>
+using namespace std;
+
+
+namespace
+{
+	using Kind = Columnar::Kind;
+	using Agg = Columnar::Agg;
+	using rows_t = Columnar::rows_t;
+
+	bool isExactNumber(Var const & v) noexcept
+	{
+		if (Var::Type::number == v.type)
+			return true;
+		return Var::Type::integer == v.type && Var::integer_t(double(v.i)) == v.i;
+	}
+
+	bool isText(Var const & v) noexcept
+	{
+		return Var::Type::string == v.type || Var::Type::strview == v.type;
+	}
+
+	Var::Type typeOf(Kind kind) noexcept
+	{
+		return Kind::number == kind ? Var::Type::number : Kind::string == kind ? Var::Type::string : Var::Type::nil;
+	}
+
+	Kind merge(Kind kind, bool seen, Var const & v) noexcept
+	{
+		auto k = isExactNumber(v) ? Kind::number : isText(v) ? Kind::string : Kind::other;
+		return !seen || kind == k ? k : Kind::other;
+	}
+
+	struct Acc
+	{
+		double		sum	= 0;
+		double		min	= numeric_limits<double>::infinity();
+		double		max	= -numeric_limits<double>::infinity();
+		size_t		n	= 0;
+
+		void add(double x) noexcept
+		{
+			sum += x;
+			min = x < min ? x : min;
+			max = x > max ? x : max;
+			++n;
+		}
+
+		Var result(Agg agg)const
+		{
+			if (Agg::count == agg)
+				return n;
+			if (Agg::sum == agg)
+				return sum;
+			if (!n)
+				return nullptr;
+			return Agg::min == agg ? min : Agg::max == agg ? max : sum / n;
+		}
+	};
+
+	//对 rows（为空时为全部行）中的每一行调用 fn(row)
+	template<typename Fn>
+	void forRows(size_t nRow, rows_t const * rows, Fn && fn)
+	{
+		if (rows) {
+			for (auto r : *rows)
+				if (r < nRow)
+					fn(r);
+		} else {
+			for (size_t r = 0; r < nRow; ++r)
+				fn(r);
+		}
+	}
+}
+
+
+Var Columnar::Column::at(size_t row)const
+{
+	if (row >= valid.size() || !valid[row])
+		return nullptr;
+	switch (kind) {
+		case Kind::number:
+			return numbers[row];
+		case Kind::string:
+			return dict[codes[row]];
+		default:
+			return values[row];
+	}
+}
+
+Columnar::Columnar(Var const & records)
+{
+	Var hold = records.force();
+	if (Var::Type::table != hold.type || !hold)
+		throw Var::TypeError(hold.type, __FUNCTION__);
+
+	vector<Var::table_t const*> rows;
+	for (Var::integer_t i = 1; ; ++i) {
+		auto p = hold.find(i);
+		if (!p)
+			break;
+		auto & row = p->force();
+		if (Var::Type::table != row.type || !row)
+			throw Var::TypeError(row.type, __FUNCTION__);
+		rows.push_back(row.t);
+	}
+	_nRow = rows.size();
+
+	//第一遍确定各列的类型
+	unordered_map<Var, bool> seen;
+	for (auto t : rows)
+		for (auto & pair : *t) {
+			auto & v = pair.second.force();
+			if (Var::Type::nil == v.type)
+				continue;
+			auto & s = seen[pair.first];
+			auto & c = _columns[pair.first];
+			c.kind = merge(c.kind, s, v);
+			s = true;
+		}
+
+	//第二遍填充
+	for (auto & pair : _columns) {
+		auto & c = pair.second;
+		c.valid.assign(_nRow, false);
+		if (Kind::number == c.kind)
+			c.numbers.assign(_nRow, 0);
+		else if (Kind::string == c.kind)
+			c.codes.assign(_nRow, 0);
+		else
+			c.values.resize(_nRow);
+	}
+	unordered_map<Var, unordered_map<string, uint32_t>> codes;
+	for (size_t r = 0; r < _nRow; ++r)
+		for (auto & pair : *rows[r]) {
+			auto & v = pair.second.force();
+			if (Var::Type::nil == v.type)
+				continue;
+			auto & c = _columns.find(pair.first)->second;
+			c.valid[r] = true;
+			if (Kind::number == c.kind) {
+				c.numbers[r] = toNumber<double>(v);
+			} else if (Kind::string == c.kind) {
+				auto s = toString(v);
+				auto ins = codes[pair.first].emplace(*s.s, uint32_t(c.dict.size()));
+				if (ins.second)
+					c.dict.push_back(*s.s);
+				c.codes[r] = ins.first->second;
+			} else {
+				c.values[r] = v;
+			}
+		}
+}
+
+Columnar::Column const * Columnar::column(Var const & key)const
+{
+	auto it = _columns.find(key);
+	return _columns.end() != it ? &it->second : nullptr;
+}
+
+Columnar::Column const & Columnar::at(Var const & key, char const * func)const
+{
+	auto p = column(key);
+	if (!p)
+		throw out_of_range(string("Call ") + func + " with a missing column");
+	return *p;
+}
+
+auto Columnar::filter(Var const & key, function<bool(Var const &)> const & fn, rows_t const * rows)const -> rows_t
+{
+	auto & c = at(key, __FUNCTION__);
+	rows_t rtn;
+	forRows(_nRow, rows, [&](size_t r) {
+		if (c.valid[r] && fn(c.at(r)))
+			rtn.push_back(r);
+	});
+	return rtn;
+}
+
+auto Columnar::filterNumber(Var const & key, function<bool(double)> const & fn, rows_t const * rows)const -> rows_t
+{
+	auto & c = at(key, __FUNCTION__);
+	if (Kind::number != c.kind)
+		throw Var::TypeError(typeOf(c.kind), __FUNCTION__);
+	rows_t rtn;
+	forRows(_nRow, rows, [&](size_t r) {
+		if (c.valid[r] && fn(c.numbers[r]))
+			rtn.push_back(r);
+	});
+	return rtn;
+}
+
+auto Columnar::filterString(Var const & key, function<bool(string const &)> const & fn, rows_t const * rows)const -> rows_t
+{
+	auto & c = at(key, __FUNCTION__);
+	if (Kind::string != c.kind)
+		throw Var::TypeError(typeOf(c.kind), __FUNCTION__);
+	//每个字典项只判断一次
+	vector<char> match(c.dict.size());
+	for (size_t i = 0; i < c.dict.size(); ++i)
+		match[i] = fn(c.dict[i]);
+	rows_t rtn;
+	forRows(_nRow, rows, [&](size_t r) {
+		if (c.valid[r] && match[c.codes[r]])
+			rtn.push_back(r);
+	});
+	return rtn;
+}
+
+Var Columnar::aggregate(Var const & key, Agg agg, rows_t const * rows)const
+{
+	auto & c = at(key, __FUNCTION__);
+	Acc acc;
+	if (Agg::count == agg) {
+		forRows(_nRow, rows, [&](size_t r) {
+			acc.n += c.valid[r];
+		});
+	} else {
+		if (Kind::number != c.kind)
+			throw Var::TypeError(typeOf(c.kind), __FUNCTION__);
+		forRows(_nRow, rows, [&](size_t r) {
+			if (c.valid[r])
+				acc.add(c.numbers[r]);
+		});
+	}
+	return acc.result(agg);
+}
+
+Var Columnar::groupBy(Var const & by, Var const & key, Agg agg, rows_t const * rows)const
+{
+	auto & g = at(by, __FUNCTION__);
+	auto & c = at(key, __FUNCTION__);
+	if (Agg::count != agg && Kind::number != c.kind)
+		throw Var::TypeError(typeOf(c.kind), __FUNCTION__);
+
+	auto add = [&](Acc & acc, size_t r) {
+		if (!c.valid[r])
+			return;
+		if (Agg::count == agg)
+			++acc.n;
+		else
+			acc.add(c.numbers[r]);
+	};
+	auto rtn = Var::table();
+	if (Kind::string == g.kind) {
+		vector<Acc> accs(g.dict.size());
+		vector<char> used(g.dict.size());
+		forRows(_nRow, rows, [&](size_t r) {
+			if (g.valid[r]) {
+				used[g.codes[r]] = true;
+				add(accs[g.codes[r]], r);
+			}
+		});
+		for (size_t i = 0; i < accs.size(); ++i)
+			if (used[i])
+				rtn[g.dict[i]] = accs[i].result(agg);
+	} else {
+		unordered_map<Var, Acc> accs;
+		forRows(_nRow, rows, [&](size_t r) {
+			if (g.valid[r])
+				add(accs[g.at(r)], r);
+		});
+		for (auto & pair : accs)
+			rtn[pair.first] = pair.second.result(agg);
+	}
+	return rtn;
+}
+
+Var Columnar::records(rows_t const * rows)const
+{
+	auto rtn = Var::table();
+	Var::integer_t i = 0;
+	forRows(_nRow, rows, [&](size_t r) {
+		auto rec = Var::table();
+		for (auto & pair : _columns)
+			if (pair.second.valid[r])
+				rec[pair.first] = pair.second.at(r);
+		rtn[++i] = rec;
+	});
+	return rtn;
+}
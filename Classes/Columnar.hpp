@@ -0,0 +1,59 @@
+﻿#ifndef COLUMNAR_HPP
+#define COLUMNAR_HPP
+
+
+#include "Var.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+//列存：把记录的序列 {rec1, rec2, ...}（各记录为键相同的表）转为按列存储。
+//某列的值全为数时存为 double，全为字符串时按字典编码，否则存为 Var；缺失的值记在位图中。
+//filter 返回行号（从 0 起）的集合，可作为 aggregate、groupBy、records 的 rows 参数，为空指针时表示全部行。
+class Columnar
+{
+public:
+	enum class Kind : char { number, string, other };
+	enum class Agg : char { count, sum, min, max, mean };
+	using rows_t = std::vector<std::size_t>;
+
+	struct Column
+	{
+		Kind						kind	= Kind::number;
+		std::vector<bool>			valid;		//空值位图
+		std::vector<double>			numbers;	//Kind::number
+		std::vector<std::uint32_t>	codes;		//Kind::string，dict 的下标
+		std::vector<std::string>	dict;
+		std::vector<Var>			values;		//Kind::other
+
+		Var at(std::size_t row)const;
+	};
+
+	explicit Columnar(Var const & records);
+
+	std::size_t size()const noexcept				{ return _nRow; }
+	Column const * column(Var const & key)const;
+
+	rows_t filter(Var const & key, std::function<bool(Var const &)> const &, rows_t const * rows = nullptr)const;
+	rows_t filterNumber(Var const & key, std::function<bool(double)> const &, rows_t const * rows = nullptr)const;
+	rows_t filterString(Var const & key, std::function<bool(std::string const &)> const &, rows_t const * rows = nullptr)const;
+
+	//count 适用于任意列，其余只适用于数值列；没有值时 min、max、mean 返回 nil
+	Var aggregate(Var const & key, Agg, rows_t const * rows = nullptr)const;
+	//按 by 列的值分组，返回 {分组值 = 聚合结果}，by 为空的行不计入
+	Var groupBy(Var const & by, Var const & key, Agg, rows_t const * rows = nullptr)const;
+	//转换回记录的序列
+	Var records(rows_t const * rows = nullptr)const;
+
+private:
+	std::size_t _nRow = 0;
+	std::unordered_map<Var, Column> _columns;
+
+	Column const & at(Var const & key, char const * func)const;
+};
+
+inline Columnar columnarize(Var const & records)	{ return Columnar(records); }
+
+
+#endif
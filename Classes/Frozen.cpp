@@ -0,0 +1,267 @@
+﻿#include "Frozen.hpp"
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+using namespace std;
+
+
+namespace
+{
+	inline uint64_t mix(uint64_t h) noexcept
+	{
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdull;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ull;
+		return h ^ h >> 33;
+	}
+
+	inline size_t bucketOf(size_t h, size_t nBucket) noexcept
+	{
+		return mix(h) % nBucket;
+	}
+
+	inline size_t slotOf(size_t h, uint32_t seed, size_t n) noexcept
+	{
+		return mix(h ^ seed * 0x9e3779b97f4a7c15ull) % n;
+	}
+
+	//std::hash<Var> 对不同类型的键可能相同（如 true 与 1），混入类型；整数与数、字符串与 strview 相等，类型按同一类计
+	size_t keyHash(Var const & k) noexcept
+	{
+		auto type = k.type;
+		if (Var::Type::integer == type)
+			type = Var::Type::number;
+		else if (Var::Type::strview == type)
+			type = Var::Type::string;
+		return hash<Var>{}(k) ^ mix(size_t(type) + 1);
+	}
+
+	bool isDeadKey(Var const & k)
+	{
+		switch (k.type) {
+			case Var::Type::function:
+			case Var::Type::closure:
+			case Var::Type::table:
+			case Var::Type::array:
+				break;
+			default:
+				return false;
+		}
+		if (k.strong)
+			return false;
+		lock_guard<decltype(Var::mrcm)> lg(Var::mrcm);
+		return !Var::mrc.count(k.t);
+	}
+
+	//冻结表的值按身份比较：字符串比内容，表、函数等比指针，其余类型相同且值相等
+	bool sameValue(Var const & a, Var const & b)
+	{
+		if (a.type != b.type)
+			return false;
+		switch (a.type) {
+			case Var::Type::string:
+			case Var::Type::strview:
+			case Var::Type::nil:
+			case Var::Type::boolean:
+			case Var::Type::number:
+			case Var::Type::integer:
+				return equal_to<Var>{}(a, b);
+			default:
+				return a.t == b.t;
+		}
+	}
+
+	size_t valueHash(Var const & v)
+	{
+		switch (v.type) {
+			case Var::Type::string:
+			case Var::Type::strview:
+			case Var::Type::nil:
+			case Var::Type::boolean:
+			case Var::Type::number:
+			case Var::Type::integer:
+				return keyHash(v);
+			default:
+				return hash<void const*>{}(v.t);
+		}
+	}
+
+	struct FrozenPool
+	{
+		mutex m;
+		unordered_multimap<size_t, weak_ptr<FrozenTable const>> tables;
+		size_t sweepAt = 64;
+	};
+}
+
+
+FrozenTable::FrozenTable(Var const & tbl)
+{
+	Var hold = tbl.force();
+	if (Var::Type::table != hold.type || !hold)
+		throw Var::TypeError(hold.type, __FUNCTION__);
+
+	//散列值相同的键只有一个进入完美散列，其余放入 _spill
+	vector<pair<size_t, Var::table_t::const_iterator>> entries;
+	entries.reserve(hold.t->size());
+	for (auto it = hold.t->cbegin(); it != hold.t->cend(); ++it)
+		if (!isDeadKey(it->first))
+			entries.emplace_back(keyHash(it->first), it);
+	_size = entries.size();
+	sort(entries.begin(), entries.end(), [](decltype(entries[0]) a, decltype(entries[0]) b) {
+		return a.first < b.first;
+	});
+	vector<size_t> hashes;
+	vector<Var::table_t::const_iterator> unique;
+	for (size_t i = 0; i < entries.size(); ++i) {
+		if (i && entries[i].first == entries[i - 1].first) {
+			spill(entries[i].first, entries[i].second->first, entries[i].second->second);
+			continue;
+		}
+		hashes.push_back(entries[i].first);
+		unique.push_back(entries[i].second);
+	}
+
+	auto n = unique.size();
+	_keys.resize(n);
+	_values.resize(n);
+	_seeds.assign(n / 2 + 1, 0);
+	if (!n)
+		return;
+
+	//按桶从大到小为每个桶找一个种子，使桶内的键落在互不相同的空位上；找不到时整桶放入 _spill
+	auto nBucket = _seeds.size();
+	vector<vector<size_t>> buckets(nBucket);
+	for (size_t i = 0; i < n; ++i)
+		buckets[bucketOf(hashes[i], nBucket)].push_back(i);
+	vector<size_t> order(nBucket);
+	for (size_t b = 0; b < nBucket; ++b)
+		order[b] = b;
+	stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return buckets[a].size() > buckets[b].size();
+	});
+
+	vector<bool> used(n);
+	vector<size_t> slots;
+	for (auto b : order) {
+		auto & keys = buckets[b];
+		if (keys.empty())
+			break;
+		for (uint32_t seed = 1; ; ++seed) {
+			if (seed > frozen::k_maxSeed) {
+				for (auto i : keys)
+					spill(hashes[i], unique[i]->first, unique[i]->second);
+				break;
+			}
+			slots.clear();
+			bool ok = true;
+			for (auto i : keys) {
+				auto s = slotOf(hashes[i], seed, n);
+				if (used[s] || slots.end() != std::find(slots.begin(), slots.end(), s)) {
+					ok = false;
+					break;
+				}
+				slots.push_back(s);
+			}
+			if (!ok)
+				continue;
+			_seeds[b] = seed;
+			for (size_t j = 0; j < keys.size(); ++j) {
+				used[slots[j]] = true;
+				_keys[slots[j]] = unique[keys[j]]->first;
+				_values[slots[j]] = unique[keys[j]]->second;
+			}
+			break;
+		}
+	}
+}
+
+void FrozenTable::spill(size_t h, Var const & key, Var const & value)
+{
+	_spillHash.push_back(h);
+	_spill.emplace_back(key, value);
+}
+
+size_t FrozenTable::slot(size_t h)const noexcept
+{
+	return slotOf(h, _seeds[bucketOf(h, _seeds.size())], _keys.size());
+}
+
+Var const * FrozenTable::find(Var::Key const & k)const
+{
+	if (_keys.empty())
+		return nullptr;
+	Var const & key = k;
+	auto h = keyHash(key);
+	auto s = slot(h);
+	if (Var::Type::nil != _keys[s].type && equal_to<Var>{}(_keys[s], key))
+		return &_values[s];
+	for (size_t i = 0; i < _spill.size(); ++i)
+		if (_spillHash[i] == h && equal_to<Var>{}(_spill[i].first, key))
+			return &_spill[i].second;
+	return nullptr;
+}
+
+Var FrozenTable::toTable()const
+{
+	auto rtn = Var::table();
+	rtn.t->reserve(_size);
+	for (size_t i = 0; i < _keys.size(); ++i)
+		if (Var::Type::nil != _keys[i].type)
+			rtn.t->emplace(_keys[i], _values[i]);
+	for (auto & pair : _spill)
+		rtn.t->emplace(pair.first, pair.second);
+	return rtn;
+}
+
+size_t FrozenTable::contentHash()const
+{
+	size_t h = mix(_size);
+	for (size_t i = 0; i < _keys.size(); ++i)
+		if (Var::Type::nil != _keys[i].type)
+			h += mix(keyHash(_keys[i]) * 31 + valueHash(_values[i]));
+	for (auto & pair : _spill)
+		h += mix(keyHash(pair.first) * 31 + valueHash(pair.second));
+	return h;
+}
+
+bool FrozenTable::sameContent(FrozenTable const & other)const
+{
+	if (_size != other._size)
+		return false;
+	for (size_t i = 0; i < _keys.size(); ++i)
+		if (Var::Type::nil != _keys[i].type) {
+			auto p = other.find(_keys[i]);
+			if (!p || !sameValue(_values[i], *p))
+				return false;
+		}
+	for (auto & pair : _spill) {
+		auto p = other.find(pair.first);
+		if (!p || !sameValue(pair.second, *p))
+			return false;
+	}
+	return true;
+}
+
+shared_ptr<FrozenTable const> canonicalize(FrozenTable const & tbl)
+{
+	static FrozenPool s_pool;
+	auto h = tbl.contentHash();
+	lock_guard<mutex> lg(s_pool.m);
+	auto range = s_pool.tables.equal_range(h);
+	for (auto it = range.first; it != range.second; ++it)
+		if (auto p = it->second.lock())
+			if (p->sameContent(tbl))
+				return p;
+
+	//池中失效的弱引用随池增长成批清除
+	if (s_pool.tables.size() >= s_pool.sweepAt) {
+		for (auto it = s_pool.tables.begin(); it != s_pool.tables.end(); )
+			it = it->second.expired() ? s_pool.tables.erase(it) : next(it);
+		s_pool.sweepAt = max<size_t>(64, s_pool.tables.size() * 2);
+	}
+	auto rtn = make_shared<FrozenTable const>(tbl);
+	s_pool.tables.emplace(h, rtn);
+	return rtn;
+}
@@ -0,0 +1,188 @@
+﻿#ifndef FROZEN_HPP
+#define FROZEN_HPP
+
+
+#include "Var.hpp"
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+
+//冻结表：建成后不可修改，以最小完美散列布局，查找只算一次散列、比较一次键，没有冲突链。
+//FrozenMap 以字符串字面量为键，可在编译期构造：
+//	constexpr auto keywords = makeFrozen<int>({{"if", 1}, {"else", 2}});
+//FrozenTable 在运行时由已有的表生成，键与值可为任意 Var。
+
+namespace frozen
+{
+	constexpr std::uint64_t hash(char const * p, std::size_t n, std::uint32_t seed) noexcept
+	{
+		std::uint64_t h = 14695981039346656037ull ^ (seed * 0x9e3779b97f4a7c15ull);
+		for (std::size_t i = 0; i < n; ++i) {
+			h ^= (unsigned char)p[i];
+			h *= 1099511628211ull;
+		}
+		return h ^ h >> 32;
+	}
+
+	constexpr std::size_t length(char const * p) noexcept
+	{
+		std::size_t n = 0;
+		while (p[n])
+			++n;
+		return n;
+	}
+
+	constexpr bool equal(char const * p, char const * q, std::size_t n) noexcept
+	{
+		for (std::size_t i = 0; i < n; ++i)
+			if (p[i] != q[i])
+				return false;
+		return true;
+	}
+
+	std::uint32_t const k_maxSeed = 1 << 20;
+}
+
+template<typename V>
+struct FrozenEntry
+{
+	char const *	key;
+	V				value;
+};
+
+template<typename V, std::size_t N>
+class FrozenMap
+{
+	static constexpr std::size_t nBucket = N / 2 + 1;
+
+	char const *	_keys[N ? N : 1]	= {};
+	std::size_t		_lens[N ? N : 1]	= {};
+	V				_values[N ? N : 1]	= {};
+	std::uint32_t	_seeds[nBucket]		= {};
+
+	constexpr std::size_t slot(char const * p, std::size_t n)const noexcept
+	{
+		return frozen::hash(p, n, _seeds[frozen::hash(p, n, 0) % nBucket]) % N;
+	}
+
+public:
+	//按桶从大到小为每个桶找一个种子，使桶内的键落在互不相同的空位上
+	constexpr explicit FrozenMap(FrozenEntry<V> const (&entries)[N])
+	{
+		std::size_t lens[N ? N : 1] = {}, bucket[N ? N : 1] = {}, count[nBucket] = {}, order[nBucket] = {};
+		bool used[N ? N : 1] = {};
+		for (std::size_t i = 0; i < N; ++i) {
+			lens[i] = frozen::length(entries[i].key);
+			bucket[i] = frozen::hash(entries[i].key, lens[i], 0) % nBucket;
+			++count[bucket[i]];
+		}
+		for (std::size_t b = 0; b < nBucket; ++b)
+			order[b] = b;
+		for (std::size_t i = 0; i < nBucket; ++i)
+			for (std::size_t j = i + 1; j < nBucket; ++j)
+				if (count[order[j]] > count[order[i]]) {
+					auto t = order[i];
+					order[i] = order[j];
+					order[j] = t;
+				}
+
+		for (std::size_t o = 0; o < nBucket && count[order[o]]; ++o) {
+			auto b = order[o];
+			for (std::uint32_t seed = 1; ; ++seed) {
+				if (seed > frozen::k_maxSeed)
+					throw std::invalid_argument("FrozenMap with duplicate keys");
+				std::size_t slots[N ? N : 1] = {}, n = 0;
+				bool ok = true;
+				for (std::size_t i = 0; i < N && ok; ++i) {
+					if (bucket[i] != b)
+						continue;
+					auto s = frozen::hash(entries[i].key, lens[i], seed) % N;
+					ok = !used[s];
+					for (std::size_t j = 0; j < n && ok; ++j)
+						ok = slots[j] != s;
+					slots[n++] = s;
+				}
+				if (!ok)
+					continue;
+				_seeds[b] = seed;
+				n = 0;
+				for (std::size_t i = 0; i < N; ++i)
+					if (bucket[i] == b) {
+						auto s = slots[n++];
+						used[s] = true;
+						_keys[s] = entries[i].key;
+						_lens[s] = lens[i];
+						_values[s] = entries[i].value;
+					}
+				break;
+			}
+		}
+	}
+
+	constexpr std::size_t size()const noexcept				{ return N; }
+
+	constexpr V const * find(char const * p, std::size_t n)const noexcept
+	{
+		if (!N)
+			return nullptr;
+		auto s = slot(p, n);
+		return _lens[s] == n && frozen::equal(_keys[s], p, n) ? &_values[s] : nullptr;
+	}
+
+	constexpr V const * find(char const * p)const noexcept	{ return find(p, frozen::length(p)); }
+
+	V const * find(Var const & var)const
+	{
+		auto & key = var.force();
+		if (Var::Type::string == key.type)
+			return find(key.s->data(), key.s->size());
+		if (Var::Type::strview == key.type)
+			return find(key.y->data, key.y->size);
+		return nullptr;
+	}
+};
+
+template<typename V, std::size_t N>
+constexpr FrozenMap<V, N> makeFrozen(FrozenEntry<V> const (&entries)[N])
+{
+	return FrozenMap<V, N>(entries);
+}
+
+class FrozenTable
+{
+public:
+	explicit FrozenTable(Var const & tbl);
+
+	std::size_t size()const noexcept						{ return _size; }
+	Var const * find(Var::Key const &)const;
+	bool contains(Var::Key const & k)const					{ return find(k) != nullptr; }
+	Var get(Var::Key const & k)const						{ auto p = find(k); return p ? *p : nullptr; }
+	//复制为普通的表
+	Var toTable()const;
+
+private:
+	std::vector<Var>			_keys;
+	std::vector<Var>			_values;
+	std::vector<std::uint32_t>	_seeds;
+	//散列值与完美散列中的键相同、或所在的桶找不到种子的项，逐个比较
+	std::vector<std::pair<Var, Var>>	_spill;
+	std::vector<std::size_t>			_spillHash;
+	std::size_t					_size = 0;
+
+	std::size_t slot(std::size_t h)const noexcept;
+	void spill(std::size_t h, Var const & key, Var const & value);
+	std::size_t contentHash()const;
+	bool sameContent(FrozenTable const &)const;
+
+	friend std::shared_ptr<FrozenTable const> canonicalize(FrozenTable const &);
+};
+
+inline FrozenTable freeze(Var const & tbl)				{ return FrozenTable(tbl); }
+//哈希合并：内容相同的冻结表返回同一份。值按身份比较（字符串按内容），1 与 1.0 不同；池只持有弱引用
+std::shared_ptr<FrozenTable const> canonicalize(FrozenTable const &);
+
+
+#endif
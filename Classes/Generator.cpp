@@ -0,0 +1,106 @@
+﻿#include "Generator.hpp"
+#include <stdexcept>
+using namespace std;
+
+
+Var generate(function<Var()> next)
+{
+	return Var::function([next](Var) {
+		return next();
+	});
+}
+
+Var range(Var::integer_t first, Var::integer_t last, Var::integer_t step)
+{
+	if (!step)
+		throw invalid_argument("range with zero step");
+	return Var::function([first, last, step](Var) mutable -> Var {
+		if (step > 0 ? first >= last : first <= last)
+			return nullptr;
+		auto rtn = first;
+		auto left = step > 0 ? uint64_t(last) - uint64_t(first) : uint64_t(first) - uint64_t(last);
+		auto stride = step > 0 ? uint64_t(step) : 0 - uint64_t(step);
+		first = left > stride ? first + step : last;
+		return rtn;
+	});
+}
+
+Var items(Var const & tbl)
+{
+	if (Var::Type::table != tbl.type)
+		throw Var::TypeError(tbl.type, __FUNCTION__);
+	Var::integer_t i = 0;
+	return generate([tbl, i]() mutable -> Var {
+		auto r = tbl.tryGet(++i);
+		return r ? std::move(r.value) : nullptr;
+	});
+}
+
+Var genMap(Var const & gen, function<Var(Var const &)> fn)
+{
+	return generate([gen, fn]() -> Var {
+		auto v = gen(nullptr);
+		return Var::Type::nil == v.type ? v : fn(v);
+	});
+}
+
+Var genMap(Var const & gen, Var const & fn)
+{
+	return genMap(gen, [fn](Var const & v) {
+		return fn(v);
+	});
+}
+
+Var genFilter(Var const & gen, function<bool(Var const &)> fn)
+{
+	return generate([gen, fn]() -> Var {
+		for (;;) {
+			auto v = gen(nullptr);
+			if (Var::Type::nil == v.type || fn(v))
+				return v;
+		}
+	});
+}
+
+Var genFilter(Var const & gen, Var const & fn)
+{
+	return genFilter(gen, [fn](Var const & v) {
+		return (bool)fn(v);
+	});
+}
+
+Var genTake(Var const & gen, size_t n)
+{
+	return generate([gen, n]() mutable -> Var {
+		if (!n)
+			return nullptr;
+		auto v = gen(nullptr);
+		n = Var::Type::nil == v.type ? 0 : n - 1;
+		return v;
+	});
+}
+
+Var genChunk(Var const & gen, size_t n)
+{
+	if (!n)
+		throw invalid_argument("genChunk with zero size");
+	return generate([gen, n]() -> Var {
+		Var rtn;
+		Var::integer_t i = 0;
+		for (Var v; size_t(i) < n && Var::Type::nil != (v = gen(nullptr)).type; ) {
+			if (!rtn)
+				rtn = Var::table();
+			rtn[++i] = std::move(v);
+		}
+		return rtn;
+	});
+}
+
+Var collect(Var const & gen)
+{
+	auto rtn = Var::table();
+	Var::integer_t i = 0;
+	for (Var v; Var::Type::nil != (v = gen(nullptr)).type; )
+		rtn[++i] = std::move(v);
+	return rtn;
+}
@@ -0,0 +1,28 @@
+﻿#ifndef GENERATOR_HPP
+#define GENERATOR_HPP
+
+
+#include "Var.hpp"
+
+
+//生成器：以 nil 调用的函数 Var，每次返回下一个值，返回 nil 表示结束（因此不能产生 nil）。
+//生成器的状态存于函数内，复制的 Var 共享同一状态；不可被多个线程同时调用。
+//组合子都是惰性的，只在被调用时从上游取值；collect 才把结果放入表。
+Var generate(std::function<Var()> next);
+//[first, last) 中的整数，step 不可为 0
+Var range(Var::integer_t first, Var::integer_t last, Var::integer_t step = 1);
+//依次产生 tbl[1]、tbl[2]……，遇到 nil 结束
+Var items(Var const & tbl);
+
+Var genMap(Var const & gen, std::function<Var(Var const &)> fn);
+Var genMap(Var const & gen, Var const & fn);
+Var genFilter(Var const & gen, std::function<bool(Var const &)> fn);
+Var genFilter(Var const & gen, Var const & fn);
+Var genTake(Var const & gen, std::size_t n);
+//每次产生不超过 n 个值组成的表 {v1, v2, ...}，n 不可为 0
+Var genChunk(Var const & gen, std::size_t n);
+//取尽生成器，返回 {v1, v2, ...}
+Var collect(Var const & gen);
+
+
+#endif
@@ -0,0 +1,208 @@
+﻿#include "Memoize.hpp"
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <mutex>
+#include <vector>
+using namespace std;
+using namespace std::chrono;
+
+
+struct Memo::State
+{
+	static size_t const npos = numeric_limits<size_t>::max();
+
+	struct Entry
+	{
+		Var						key;
+		size_t					hash;
+		Var						value;
+		steady_clock::time_point expire;
+		size_t					prev;
+		size_t					next;
+		bool					referenced;
+	};
+
+	Var							fn;
+	size_t						capacity;
+	Policy						policy;
+	nanoseconds					ttl;
+	mutex						m;
+	vector<Entry>				slots;
+	unordered_multimap<size_t, size_t>	index;	//deepHash → slots 下标
+	size_t						head = npos;	//LRU：最近使用
+	size_t						tail = npos;	//LRU：最久未用
+	size_t						hand = 0;		//CLOCK：指针
+	atomic<size_t>				hits{0};
+	atomic<size_t>				misses{0};
+
+	State(Var const & fn, size_t capacity, Policy policy, nanoseconds ttl)
+		: fn(fn), capacity(capacity), policy(policy), ttl(ttl)
+	{
+	}
+
+	void unlink(size_t i)
+	{
+		auto & e = slots[i];
+		(npos == e.prev ? head : slots[e.prev].next) = e.next;
+		(npos == e.next ? tail : slots[e.next].prev) = e.prev;
+	}
+
+	void pushFront(size_t i)
+	{
+		auto & e = slots[i];
+		e.prev = npos;
+		e.next = head;
+		(npos == head ? tail : slots[head].prev) = i;
+		head = i;
+	}
+
+	void touch(size_t i)
+	{
+		if (Policy::clock == policy) {
+			slots[i].referenced = true;
+		} else if (head != i) {
+			unlink(i);
+			pushFront(i);
+		}
+	}
+
+	size_t victim()
+	{
+		if (Policy::lru == policy)
+			return tail;
+		while (slots[hand].referenced) {
+			slots[hand].referenced = false;
+			hand = (hand + 1) % slots.size();
+		}
+		auto i = hand;
+		hand = (hand + 1) % slots.size();
+		return i;
+	}
+
+	steady_clock::time_point expireAt()const
+	{
+		if (ttl.count())
+			return steady_clock::now() + ttl;
+		return steady_clock::time_point::max();
+	}
+
+	//调用者持有 m
+	size_t lookup(Var const & args, size_t h)const
+	{
+		auto range = index.equal_range(h);
+		for (auto it = range.first; it != range.second; ++it)
+			if (deepEqual(slots[it->second].key, args))
+				return it->second;
+		return npos;
+	}
+
+	bool find(Var const & args, size_t h, Var & out)
+	{
+		lock_guard<mutex> lg(m);
+		auto i = lookup(args, h);
+		if (npos == i || slots[i].expire <= steady_clock::now())
+			return false;
+		touch(i);
+		out = slots[i].value;
+		return true;
+	}
+
+	void insert(Var const & args, size_t h, Var const & value)
+	{
+		//表与数组深复制，避免调用者修改后键与散列值不符
+		auto key = Var::Type::table == args.type || Var::Type::array == args.type ? deepClone(args) : args;
+		lock_guard<mutex> lg(m);
+		auto i = lookup(args, h);
+		if (npos != i) {
+			auto & e = slots[i];
+			e.value = value;
+			e.expire = expireAt();
+			touch(i);
+			return;
+		}
+		if (slots.size() < capacity) {
+			i = slots.size();
+			slots.push_back({key, h, value, expireAt(), npos, npos, false});
+		} else {
+			i = victim();
+			auto range = index.equal_range(slots[i].hash);
+			index.erase(find_if(range.first, range.second, [i](pair<size_t const, size_t> const & e) { return e.second == i; }));
+			if (Policy::lru == policy)
+				unlink(i);
+			slots[i].key = key;
+			slots[i].hash = h;
+			slots[i].value = value;
+			slots[i].expire = expireAt();
+			slots[i].referenced = false;
+		}
+		if (Policy::lru == policy)
+			pushFront(i);
+		index.emplace(h, i);
+	}
+
+	Var call(Var const & args)
+	{
+		auto h = deepHash(args);
+		Var rtn;
+		if (find(args, h, rtn)) {
+			++hits;
+			return rtn;
+		}
+		++misses;
+		rtn = fn(args);
+		if (capacity)
+			insert(args, h, rtn);
+		return rtn;
+	}
+};
+
+
+Memo::Memo(Var const & fn, size_t capacity, Policy policy, nanoseconds ttl)
+	: _state(make_shared<State>(fn, capacity, policy, ttl))
+{
+}
+
+Var Memo::operator()(Var const & args)const
+{
+	return _state->call(args);
+}
+
+Var Memo::function()const
+{
+	auto state = _state;
+	return Var::function([state](Var args) {
+		return state->call(args);
+	});
+}
+
+size_t Memo::hits()const noexcept
+{
+	return _state->hits;
+}
+
+size_t Memo::misses()const noexcept
+{
+	return _state->misses;
+}
+
+size_t Memo::size()const
+{
+	lock_guard<mutex> lg(_state->m);
+	return _state->index.size();
+}
+
+void Memo::clear()
+{
+	lock_guard<mutex> lg(_state->m);
+	_state->slots.clear();
+	_state->index.clear();
+	_state->head = _state->tail = State::npos;
+	_state->hand = 0;
+}
+
+
+Var memoize(Var const & fn, size_t capacity, Memo::Policy policy, nanoseconds ttl)
+{
+	return Memo(fn, capacity, policy, ttl).function();
+}
@@ -0,0 +1,41 @@
+﻿#ifndef MEMOIZE_HPP
+#define MEMOIZE_HPP
+
+
+#include "Var.hpp"
+#include <chrono>
+#include <cstddef>
+#include <memory>
+
+
+//函数缓存：参数按内容为键（deepHash 与 deepEqual），{a, b} 这样每次新建的参数表也能命中；
+//表与数组参数存入时深复制，调用者此后修改原参数不影响缓存。容量有界。
+//可被多个线程同时调用；缓存由自己的互斥量保护，fn 在锁外执行，
+//同一参数并发未命中时 fn 可能被调用多次。fn 应为纯函数。
+class Memo
+{
+public:
+	enum class Policy : char { lru, clock };
+
+	//ttl 为 0 表示不过期
+	Memo(Var const & fn, std::size_t capacity, Policy = Policy::lru, std::chrono::nanoseconds ttl = {});
+
+	Var operator()(Var const & args)const;
+	//共享同一缓存的函数 Var
+	Var function()const;
+
+	std::size_t hits()const noexcept;
+	std::size_t misses()const noexcept;
+	std::size_t size()const;
+	void clear();
+
+private:
+	struct State;
+	std::shared_ptr<State> _state;
+};
+
+//返回带缓存的函数 Var，可直接替换 fn；要取命中统计或清空缓存时改用 Memo 并取其 function()
+Var memoize(Var const & fn, std::size_t capacity, Memo::Policy = Memo::Policy::lru, std::chrono::nanoseconds ttl = {});
+
+
+#endif
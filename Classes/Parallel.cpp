@@ -0,0 +1,150 @@
+﻿#include "Parallel.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <atomic>
+using namespace std;
+
+
+namespace
+{
+	size_t const k_serialMax = 1024;
+
+	Var::table_t & tableOf(Var const & var, char const * func)
+	{
+		auto & tbl = var.force();
+		if (Var::Type::table != tbl.type || !tbl)
+			throw Var::TypeError(tbl.type, func);
+		return *tbl.t;
+	}
+
+	size_t chunkCount(Var::table_t const & t)
+	{
+		if (t.size() < k_serialMax)
+			return 1;
+		return min(t.bucket_count(), size_t(util::ThreadPool::shared().size() + 1) * 4);
+	}
+
+	//body(i, first, last) 处理第 i 段的桶 [first, last)
+	void forChunks(Var::table_t const & t, size_t nChunk, function<void(size_t, size_t, size_t)> const & body)
+	{
+		auto nBucket = t.bucket_count();
+		if (nChunk < 2)
+			return body(0, 0, nBucket);
+		util::ThreadPool::shared().parallelFor(nChunk, [&](size_t i) {
+			body(i, nBucket * i / nChunk, nBucket * (i + 1) / nChunk);
+		});
+	}
+}
+
+
+void parallelForEach(Var const & tbl, function<void(Var const &, Var &)> const & fn)
+{
+	Var hold = tbl;
+	auto & t = tableOf(hold, __FUNCTION__);
+	hold.touch();
+	forChunks(t, chunkCount(t), [&](size_t, size_t first, size_t last) {
+		for (auto b = first; b < last; ++b)
+			for (auto it = t.begin(b); it != t.end(b); ++it)
+				fn(it->first, it->second);
+	});
+}
+
+void parallelForEach(Var const & tbl, Var const & fn)
+{
+	parallelForEach(tbl, [&fn](Var const & k, Var & v) {
+		Var args = Var::table();
+		args[1] = k;
+		args[2] = v;
+		fn(args);
+	});
+}
+
+Var parallelMap(Var const & tbl, function<Var(Var const &, Var const &)> const & fn)
+{
+	Var hold = tbl;
+	auto & src = tableOf(hold, __FUNCTION__);
+	Var rtn = Var::table();
+	auto & t = *rtn.t;
+	static_cast<Var::map_t &>(t) = src;
+	t.nWeakKey = src.nWeakKey;
+	atomic<bool> hasNil{false};
+	forChunks(t, chunkCount(t), [&](size_t, size_t first, size_t last) {
+		for (auto b = first; b < last; ++b)
+			for (auto it = t.begin(b); it != t.end(b); ++it)
+				if (Var::Type::nil == (it->second = fn(it->first, it->second)).type)
+					hasNil = true;
+	});
+	if (hasNil)
+		for (auto it = t.begin(); it != t.end(); )
+			it = Var::Type::nil == it->second.type ? t.erase(it) : ++it;
+	return rtn;
+}
+
+Var parallelMap(Var const & tbl, Var const & fn)
+{
+	return parallelMap(tbl, [&fn](Var const &, Var const & v) {
+		return fn(v);
+	});
+}
+
+Var parallelFilter(Var const & tbl, function<bool(Var const &, Var const &)> const & fn)
+{
+	using entry_t = Var::table_t::value_type;
+	Var hold = tbl;
+	auto & t = tableOf(hold, __FUNCTION__);
+	auto nChunk = chunkCount(t);
+	vector<vector<entry_t const*>> kept(nChunk);
+	forChunks(t, nChunk, [&](size_t i, size_t first, size_t last) {
+		for (auto b = first; b < last; ++b)
+			for (auto it = t.cbegin(b); it != t.cend(b); ++it)
+				if (fn(it->first, it->second))
+					kept[i].push_back(&*it);
+	});
+
+	Var rtn = Var::table();
+	size_t n = 0;
+	for (auto & v : kept)
+		n += v.size();
+	rtn.t->reserve(n);
+	for (auto & v : kept)
+		for (auto p : v)
+			rtn.t->emplace(*p);
+	return rtn;
+}
+
+Var parallelFilter(Var const & tbl, Var const & fn)
+{
+	return parallelFilter(tbl, [&fn](Var const &, Var const & v) {
+		return (bool)fn(v);
+	});
+}
+
+Var parallelReduce(Var const & tbl, Var const & init, function<Var(Var const &, Var const &)> const & combine)
+{
+	Var hold = tbl;
+	auto & t = tableOf(hold, __FUNCTION__);
+	auto nChunk = chunkCount(t);
+	vector<Var> partial(nChunk, init);
+	forChunks(t, nChunk, [&](size_t i, size_t first, size_t last) {
+		auto & acc = partial[i];
+		for (auto b = first; b < last; ++b)
+			for (auto it = t.cbegin(b); it != t.cend(b); ++it)
+				acc = combine(acc, it->second);
+	});
+
+	Var rtn = std::move(partial[0]);
+	for (size_t i = 1; i < nChunk; ++i)
+		rtn = combine(rtn, partial[i]);
+	return rtn;
+}
+
+Var parallelReduce(Var const & tbl, Var const & init, Var const & combine)
+{
+	//不用 {acc, v}：初始化列表跳过 nil，acc 为 nil 时 v 会落到 1 号位
+	return parallelReduce(tbl, init, [&combine](Var const & acc, Var const & v) {
+		Var args = Var::table();
+		args[1] = acc;
+		args[2] = v;
+		return combine(args);
+	});
+}
@@ -0,0 +1,26 @@
+﻿#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+
+#include "Var.hpp"
+
+
+//并行算法：把表的桶分段，交给 util::ThreadPool::shared() 执行，小表直接在调用线程执行。
+//body 中可以：读取 Var，复制、销毁 Var（引用计数有锁保护），修改传入的 v，调用函数；
+//不可以：对正在遍历的表插入或删除键（包括以 Var & 取不存在的键），
+//		  在多个任务间无同步地写同一个表，依赖各元素的执行顺序。
+//弱引用的检查持有 Var::mrcm，但失效的弱引用在检查时被就地改为 nil：多个任务会检查的同一个弱引用
+//（而非各自的 v）须事先复制为强引用，或由调用方同步。
+//Var 函数的参数：forEach 为 {k, v}，map、filter 为 v，reduce 为 {acc, v}。
+//reduce 的 init 须为 combine 的单位元，combine 须满足结合律。
+void parallelForEach(Var const & tbl, std::function<void(Var const & k, Var & v)> const &);
+void parallelForEach(Var const & tbl, Var const & fn);
+Var parallelMap(Var const & tbl, std::function<Var(Var const & k, Var const & v)> const &);
+Var parallelMap(Var const & tbl, Var const & fn);
+Var parallelFilter(Var const & tbl, std::function<bool(Var const & k, Var const & v)> const &);
+Var parallelFilter(Var const & tbl, Var const & fn);
+Var parallelReduce(Var const & tbl, Var const & init, std::function<Var(Var const &, Var const &)> const & combine);
+Var parallelReduce(Var const & tbl, Var const & init, Var const & combine);
+
+
+#endif
@@ -0,0 +1,171 @@
+﻿#include "Profiler.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+using namespace std;
+
+
+std::atomic<bool> Profiler::s_on{false};
+
+
+namespace
+{
+	using steady_t = chrono::steady_clock;
+
+	struct Frame
+	{
+		void const *			id;
+		steady_t::time_point		start;
+		chrono::nanoseconds		child;
+	};
+
+	struct Entry
+	{
+		uint64_t				calls	= 0;
+		chrono::nanoseconds		total{};
+		chrono::nanoseconds		self{};
+		uint64_t				histogram[Profiler::k_buckets] = {};
+	};
+
+	mutex g_m;
+	unordered_map<void const *, Entry> g_entries;
+	unordered_map<void const *, string> g_names;
+	map<vector<void const *>, chrono::nanoseconds> g_stacks;
+	thread_local vector<Frame> t_frames;
+
+	int bucketOf(chrono::nanoseconds d) noexcept
+	{
+		auto n = uint64_t(max<int64_t>(d.count(), 1));
+		int i = 0;
+		while (n >>= 1)
+			++i;
+		return min(i, Profiler::k_buckets - 1);
+	}
+
+	//须持有 g_m
+	string nameOf(void const * id)
+	{
+		auto it = g_names.find(id);
+		if (g_names.end() != it)
+			return it->second;
+		char buf[32];
+		snprintf(buf, sizeof(buf), "fn@%p", id);
+		return buf;
+	}
+}
+
+
+void Profiler::tag(Var const & fn, string name)
+{
+	if (Var::Type::lazy == fn.type)
+		return tag(fn.force(), std::move(name));
+	void const * id;
+	if (Var::Type::native == fn.type)
+		id = reinterpret_cast<void const *>(fn.p);
+	else if (Var::Type::function == fn.type || Var::Type::closure == fn.type)
+		id = fn.t;
+	else
+		throw Var::TypeError(fn.type, __FUNCTION__);
+	lock_guard<mutex> lg(g_m);
+	g_names[id] = move(name);
+}
+
+void Profiler::reset()
+{
+	lock_guard<mutex> lg(g_m);
+	g_entries.clear();
+	g_names.clear();
+	g_stacks.clear();
+}
+
+vector<Profiler::Stats> Profiler::stats()
+{
+	vector<Stats> rtn;
+	{
+		lock_guard<mutex> lg(g_m);
+		rtn.reserve(g_entries.size());
+		for (auto & pair : g_entries) {
+			rtn.emplace_back();
+			auto & s = rtn.back();
+			s.name = nameOf(pair.first);
+			s.calls = pair.second.calls;
+			s.total = pair.second.total;
+			s.self = pair.second.self;
+			copy_n(pair.second.histogram, k_buckets, s.histogram);
+		}
+	}
+	sort(rtn.begin(), rtn.end(), [](Stats const & a, Stats const & b) { return a.self > b.self; });
+	return rtn;
+}
+
+string Profiler::report()
+{
+	//分位数取所在格的上界
+	auto quantile = [](Stats const & s, double q) {
+		auto rank = uint64_t(q * (s.calls - 1));
+		uint64_t n = 0;
+		for (int i = 0; i < k_buckets; ++i)
+			if ((n += s.histogram[i]) > rank)
+				return double(uint64_t(2) << i) / 1e3;
+		return 0.0;
+	};
+	string rtn = "name\tcalls\ttotal(ms)\tself(ms)\tmean(us)\tp50(us)\tp99(us)\n";
+	char buf[256];
+	for (auto & s : stats()) {
+		snprintf(buf, sizeof(buf), "\t%llu\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\n", (unsigned long long)s.calls,
+			s.total.count() / 1e6, s.self.count() / 1e6, s.total.count() / 1e3 / s.calls,
+			quantile(s, 0.5), quantile(s, 0.99));
+		rtn += s.name;
+		rtn += buf;
+	}
+	return rtn;
+}
+
+string Profiler::collapsed()
+{
+	lock_guard<mutex> lg(g_m);
+	string rtn;
+	for (auto & pair : g_stacks) {
+		for (size_t i = 0; i < pair.first.size(); ++i) {
+			if (i)
+				rtn += ';';
+			rtn += nameOf(pair.first[i]);
+		}
+		rtn += ' ';
+		rtn += to_string(pair.second.count());
+		rtn += '\n';
+	}
+	return rtn;
+}
+
+void Profiler::enter(void const * id)
+{
+	t_frames.push_back({id, steady_t::now(), {}});
+}
+
+void Profiler::leave() noexcept
+{
+	auto now = steady_t::now();
+	auto frame = t_frames.back();
+	auto elapsed = chrono::duration_cast<chrono::nanoseconds>(now - frame.start);
+	auto self = elapsed - frame.child;
+	try {
+		vector<void const *> stack;
+		stack.reserve(t_frames.size());
+		for (auto & f : t_frames)
+			stack.push_back(f.id);
+		lock_guard<mutex> lg(g_m);
+		auto & e = g_entries[frame.id];
+		++e.calls;
+		e.total += elapsed;
+		e.self += self;
+		++e.histogram[bucketOf(elapsed)];
+		g_stacks[move(stack)] += self;
+	} catch (...) {
+	}
+	t_frames.pop_back();
+	if (!t_frames.empty())
+		t_frames.back().child += elapsed;
+}
@@ -0,0 +1,64 @@
+﻿#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+
+#include "Var.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+//函数调用剖析：开启后 Var::operator()、Ref::operator() 对每个函数 Var 统计调用次数、
+//累计时间（含被调用者）、自身时间与耗时直方图。关闭时每次调用只多读一个原子变量。
+//函数以其 payload 的地址区分，可用 tag 命名，未命名时显示为地址。函数释放后地址可能被新的函数复用，
+//统计与名字随之归到新函数名下：只剖析存活的函数，换一批函数前调用 reset，reset 同时清除统计与名字。
+class Profiler
+{
+public:
+	//直方图第 i 格为耗时在 [2^i, 2^(i+1)) 纳秒内的调用数
+	static constexpr int k_buckets = 40;
+
+	struct Stats
+	{
+		std::string					name;
+		std::uint64_t				calls	= 0;
+		std::chrono::nanoseconds	total{};
+		std::chrono::nanoseconds	self{};
+		std::uint64_t				histogram[k_buckets] = {};
+	};
+
+	static void enable(bool on = true) noexcept				{ s_on.store(on, std::memory_order_relaxed); }
+	static bool enabled() noexcept							{ return s_on.load(std::memory_order_relaxed); }
+	static void tag(Var const & fn, std::string name);
+	static void reset();
+
+	//按自身时间降序
+	static std::vector<Stats> stats();
+	//平铺报告，每个函数一行
+	static std::string report();
+	//折叠调用栈，每行为“调用者;被调用者 自身纳秒数”，供火焰图使用
+	static std::string collapsed();
+
+	//由 Var 在调用前后使用
+	class Scope
+	{
+		bool _on;
+
+	public:
+		explicit Scope(void const * id)						: _on(enabled()) { if (_on) enter(id); }
+		~Scope()											{ if (_on) leave(); }
+		Scope(Scope const &)								= delete;
+		Scope & operator=(Scope const &)					= delete;
+	};
+
+private:
+	static std::atomic<bool> s_on;
+
+	static void enter(void const *);
+	static void leave() noexcept;
+};
+
+
+#endif
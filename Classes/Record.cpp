@@ -0,0 +1,185 @@
+﻿#include "Record.hpp"
+#include <algorithm>
+using namespace std;
+
+
+namespace
+{
+	inline bool isText(Var const & v) noexcept
+	{
+		return Var::Type::string == v.type || Var::Type::strview == v.type;
+	}
+
+	inline string textOf(Var const & v)
+	{
+		return Var::Type::string == v.type ? *v.s : string(v.y->data, v.y->size);
+	}
+}
+
+
+Shape const * Shape::empty() noexcept
+{
+	static Shape const s_empty;
+	return &s_empty;
+}
+
+Shape const * Shape::with(Var const & key)const
+{
+	if (_index.count(key))
+		return this;
+	if (!isText(key))
+		throw Var::TypeError(key.type, __FUNCTION__);
+
+	lock_guard<mutex> lg(_m);
+	auto it = _next.find(key);
+	if (_next.end() != it)
+		return it->second.get();
+	unique_ptr<Shape> next(new Shape);
+	Var k = textOf(key);
+	next->_keys = _keys;
+	next->_keys.push_back(k);
+	next->_index = _index;
+	next->_index.emplace(k, int(_keys.size()));
+	return _next.emplace(k, move(next)).first->second.get();
+}
+
+int Shape::slot(Var const & key)const
+{
+	auto it = _index.find(key);
+	return _index.end() == it ? -1 : it->second;
+}
+
+
+Record::Record(Var const & tbl)
+	: _shape(Shape::empty())
+{
+	Var hold = tbl.force();
+	if (Var::Type::table != hold.type || !hold)
+		throw Var::TypeError(hold.type, __FUNCTION__);
+
+	vector<pair<string, Var const *>> fields;
+	fields.reserve(hold.t->size());
+	for (auto & pair : *hold.t) {
+		if (!isText(pair.first) || fields.size() == maxSlots) {
+			_dict = Var::table();
+			static_cast<Var::map_t &>(*_dict.t) = *hold.t;
+			_shape = nullptr;
+			return;
+		}
+		fields.emplace_back(textOf(pair.first), &pair.second);
+	}
+	sort(fields.begin(), fields.end(), [](decltype(fields[0]) a, decltype(fields[0]) b) {
+		return a.first < b.first;
+	});
+	_slots.reserve(fields.size());
+	for (auto & f : fields) {
+		_shape = _shape->with(f.first);
+		_slots.push_back(*f.second);
+	}
+}
+
+Record::Record(Record const & rhs)
+	: _shape(rhs._shape)
+	, _slots(rhs._slots)
+{
+	if (!_shape) {
+		_dict = Var::table();
+		static_cast<Var::map_t &>(*_dict.t) = *rhs._dict.t;
+	}
+}
+
+Record::Record(Record && rhs) noexcept
+	: _shape(rhs._shape)
+	, _slots(move(rhs._slots))
+	, _dict(move(rhs._dict))
+{
+	rhs._shape = Shape::empty();
+	rhs._slots.clear();
+}
+
+Record & Record::operator=(Record rhs)
+{
+	_shape = rhs._shape;
+	_slots.swap(rhs._slots);
+	_dict.swap(rhs._dict);
+	return *this;
+}
+
+Var const * Record::find(Var::Key const & k)const
+{
+	Var const & key = k;
+	if (!_shape) {
+		auto it = _dict.t->find(key);
+		return _dict.t->end() == it ? nullptr : &it->second;
+	}
+	auto i = _shape->slot(key);
+	return i < 0 ? nullptr : &_slots[i];
+}
+
+void Record::set(Var::Key const & k, Var val)
+{
+	Var const & key = k;
+	if (_shape) {
+		auto i = _shape->slot(key);
+		if (i >= 0) {
+			_slots[i] = move(val);
+			return;
+		}
+		if (isText(key) && _shape->size() < maxSlots) {
+			_shape = _shape->with(key);
+			_slots.push_back(move(val));
+			return;
+		}
+		deopt();
+	}
+	(*_dict.t)[Var(key)] = move(val);
+}
+
+size_t Record::size()const
+{
+	if (!_shape)
+		return _dict.t->size();
+	return count_if(_slots.begin(), _slots.end(), [](Var const & v) { return Var::nil != v; });
+}
+
+Var Record::toTable()const
+{
+	auto rtn = Var::table();
+	if (!_shape) {
+		static_cast<Var::map_t &>(*rtn.t) = *_dict.t;
+		return rtn;
+	}
+	rtn.t->reserve(_slots.size());
+	auto & keys = _shape->keys();
+	for (size_t i = 0; i < _slots.size(); ++i)
+		if (Var::nil != _slots[i])
+			rtn.t->emplace(keys[i], _slots[i]);
+	return rtn;
+}
+
+void Record::deopt()
+{
+	_dict = Var::table();
+	_dict.t->reserve(_slots.size());
+	auto & keys = _shape->keys();
+	for (size_t i = 0; i < _slots.size(); ++i)
+		_dict.t->emplace(keys[i], move(_slots[i]));
+	_slots.clear();
+	_slots.shrink_to_fit();
+	_shape = nullptr;
+}
+
+
+Var const * FieldCache::find(Record const & r)const
+{
+	if (r._shape && r._shape == _shape)
+		return &r._slots[_slot];
+	if (!r._shape)
+		return r.find(_key);
+	auto i = r._shape->slot(_key);
+	if (i < 0)
+		return nullptr;
+	_shape = r._shape;
+	_slot = i;
+	return &r._slots[i];
+}
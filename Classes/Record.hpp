@@ -0,0 +1,81 @@
+﻿#ifndef RECORD_HPP
+#define RECORD_HPP
+
+
+#include "Var.hpp"
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+
+//隐藏类：键相同、添加顺序相同的记录共享一个 Shape，Shape 把键映射为下标，值存于记录自己的数组。
+//Shape 一经创建不再改变也不释放，添加键时经转移表得到下一个 Shape。
+class Shape
+{
+public:
+	static Shape const * empty() noexcept;
+
+	//添加 key（须为字符串）后的 Shape，key 已存在时返回自身
+	Shape const * with(Var const & key)const;
+	//key 的下标，不存在时为 -1
+	int slot(Var const & key)const;
+
+	std::size_t size()const noexcept					{ return _keys.size(); }
+	std::vector<Var> const & keys()const noexcept		{ return _keys; }
+
+private:
+	std::vector<Var>							_keys;
+	std::unordered_map<Var, int>				_index;
+	mutable std::mutex							_m;
+	mutable std::unordered_map<Var, std::unique_ptr<Shape>>	_next;
+};
+
+//按 Shape 存储的记录。键不是字符串或多于 maxSlots 个时退化为普通的表。
+//赋 nil 只清空下标处的值，不改变 Shape
+class Record
+{
+public:
+	static constexpr std::size_t maxSlots = 64;
+
+	Record() noexcept									: _shape(Shape::empty()) {}
+	//键按字典序加入，键集合相同的表得到同一个 Shape
+	explicit Record(Var const & tbl);
+	Record(Record const &);
+	Record(Record &&) noexcept;
+	Record & operator=(Record);
+
+	Var const * find(Var::Key const &)const;
+	Var get(Var::Key const & k)const					{ auto p = find(k); return p ? *p : nullptr; }
+	void set(Var::Key const &, Var);
+	//值不为 nil 的字段数
+	std::size_t size()const;
+	//退化为表后为空指针
+	Shape const * shape()const noexcept					{ return _shape; }
+	Var toTable()const;
+
+private:
+	Shape const *		_shape;
+	std::vector<Var>	_slots;
+	Var					_dict;
+
+	friend class FieldCache;
+	void deopt();
+};
+
+//内联缓存：记住上次遇到的 Shape 与下标，Shape 相同时直接取下标处的值。不可跨线程共享
+class FieldCache
+{
+	Var						_key;
+	mutable Shape const *	_shape	= nullptr;
+	mutable int				_slot	= -1;
+
+public:
+	explicit FieldCache(Var::Key const & key)			: _key(static_cast<Var const &>(key)) {}
+
+	Var const * find(Record const &)const;
+	Var get(Record const & r)const						{ auto p = find(r); return p ? *p : nullptr; }
+};
+
+
+#endif
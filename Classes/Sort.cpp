@@ -0,0 +1,200 @@
+﻿#include "Sort.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+using namespace std;
+
+
+namespace
+{
+	using less_t = function<bool(Var const &, Var const &)>;
+
+	size_t const k_parallelMin = 1 << 14;
+
+	//对序列的下标排序，值留在表中；commit 时才按 order 一次移动到位，less 抛出异常时表不变
+	class Sequence
+	{
+		Var _hold;
+		vector<Var*> _slots;
+		vector<Var const*> _values;
+
+	public:
+		vector<size_t> order;
+
+		Sequence(Var const & tbl, char const * func)
+			: _hold(tbl.force())
+		{
+			if (Var::Type::table != _hold.type || !_hold)
+				throw Var::TypeError(_hold.type, func);
+			auto & t = *_hold.t;
+			for (Var::integer_t i = 1; ; ++i) {
+				auto it = t.find(i);
+				if (t.end() == it)
+					break;
+				_slots.push_back(&it->second);
+				_values.push_back(&it->second.force());
+			}
+			order.resize(_slots.size());
+			for (size_t i = 0; i < order.size(); ++i)
+				order[i] = i;
+		}
+
+		//按下标比较；复制时 less 也被复制，函数 Var 的参数表随之新建
+		struct Less
+		{
+			vector<Var const*> const * values;
+			less_t less;
+
+			bool operator()(size_t a, size_t b)const	{ return less(*(*values)[a], *(*values)[b]); }
+		};
+		Less lessOf(less_t const & less)const		{ return Less{&_values, less}; }
+
+		void commit()
+		{
+			vector<Var> sorted;
+			sorted.reserve(order.size());
+			for (auto i : order)
+				sorted.push_back(std::move(*_slots[i]));
+			for (size_t i = 0; i < _slots.size(); ++i)
+				*_slots[i] = std::move(sorted[i]);
+			_hold.touch();
+		}
+	};
+
+	less_t lessOf(less_t const & less)
+	{
+		if (less)
+			return less;
+		return [](Var const & a, Var const & b) {
+			return a < b;
+		};
+	}
+
+	//以 {a, b} 调用函数 Var：参数表只在构造与复制时新建，同一比较器的各次调用复用它。
+	//并行排序时每个任务持有自己的副本
+	struct VarLess
+	{
+		Var fn;
+		Var args = Var::table();
+
+		VarLess(Var const & fn)					: fn(fn) {}
+		VarLess(VarLess const & rhs)			: fn(rhs.fn) {}
+		VarLess & operator=(VarLess const &)	= delete;
+
+		bool operator()(Var const & a, Var const & b)const
+		{
+			args[1] = a;
+			args[2] = b;
+			return (bool)fn(args);
+		}
+	};
+
+	less_t lessOf(Var const & less)
+	{
+		return VarLess(less);
+	}
+
+	using order_t = vector<size_t>;
+
+	//分段排序，再两两归并；每个任务复制一份 less
+	template<typename SortFn>
+	void mergeSort(order_t & v, Sequence::Less const & less, SortFn sortFn)
+	{
+		auto & pool = util::ThreadPool::shared();
+		size_t nChunk = pool.size() + 1;
+		if (v.size() < k_parallelMin || nChunk < 2)
+			return sortFn(v.begin(), v.end(), less);
+
+		vector<size_t> bounds(nChunk + 1);
+		for (size_t i = 0; i <= nChunk; ++i)
+			bounds[i] = v.size() * i / nChunk;
+		pool.parallelFor(nChunk, [&](size_t i) {
+			auto local = less;
+			sortFn(v.begin() + bounds[i], v.begin() + bounds[i + 1], local);
+		});
+		for (size_t width = 1; width < nChunk; width *= 2) {
+			auto nPair = (nChunk + width * 2 - 1) / (width * 2);
+			pool.parallelFor(nPair, [&](size_t i) {
+				auto lo = i * width * 2, mid = min(lo + width, nChunk), hi = min(lo + width * 2, nChunk);
+				auto local = less;
+				if (mid < hi)
+					inplace_merge(v.begin() + bounds[lo], v.begin() + bounds[mid], v.begin() + bounds[hi], local);
+			});
+		}
+	}
+
+	void sortImpl(Var const & tbl, less_t const & less, char const * func)
+	{
+		Sequence seq(tbl, func);
+		mergeSort(seq.order, seq.lessOf(less), [](order_t::iterator first, order_t::iterator last, Sequence::Less const & less) {
+			std::sort(first, last, less);
+		});
+		seq.commit();
+	}
+
+	void stableSortImpl(Var const & tbl, less_t const & less, char const * func)
+	{
+		Sequence seq(tbl, func);
+		mergeSort(seq.order, seq.lessOf(less), [](order_t::iterator first, order_t::iterator last, Sequence::Less const & less) {
+			std::stable_sort(first, last, less);
+		});
+		seq.commit();
+	}
+
+	void partialSortImpl(Var const & tbl, size_t k, less_t const & less, char const * func)
+	{
+		Sequence seq(tbl, func);
+		auto & v = seq.order;
+		std::partial_sort(v.begin(), v.begin() + min(k, v.size()), v.end(), seq.lessOf(less));
+		seq.commit();
+	}
+
+	void nthElementImpl(Var const & tbl, size_t nth, less_t const & less, char const * func)
+	{
+		Sequence seq(tbl, func);
+		auto & v = seq.order;
+		if (nth && nth <= v.size())
+			std::nth_element(v.begin(), v.begin() + (nth - 1), v.end(), seq.lessOf(less));
+		seq.commit();
+	}
+}
+
+
+void sort(Var const & tbl, less_t const & less)
+{
+	sortImpl(tbl, lessOf(less), __FUNCTION__);
+}
+
+void sort(Var const & tbl, Var const & less)
+{
+	sortImpl(tbl, lessOf(less), __FUNCTION__);
+}
+
+void stableSort(Var const & tbl, less_t const & less)
+{
+	stableSortImpl(tbl, lessOf(less), __FUNCTION__);
+}
+
+void stableSort(Var const & tbl, Var const & less)
+{
+	stableSortImpl(tbl, lessOf(less), __FUNCTION__);
+}
+
+void partialSort(Var const & tbl, size_t k, less_t const & less)
+{
+	partialSortImpl(tbl, k, lessOf(less), __FUNCTION__);
+}
+
+void partialSort(Var const & tbl, size_t k, Var const & less)
+{
+	partialSortImpl(tbl, k, lessOf(less), __FUNCTION__);
+}
+
+void nthElement(Var const & tbl, size_t nth, less_t const & less)
+{
+	nthElementImpl(tbl, nth, lessOf(less), __FUNCTION__);
+}
+
+void nthElement(Var const & tbl, size_t nth, Var const & less)
+{
+	nthElementImpl(tbl, nth, lessOf(less), __FUNCTION__);
+}
@@ -0,0 +1,25 @@
+﻿#ifndef SORT_HPP
+#define SORT_HPP
+
+
+#include "Var.hpp"
+
+
+//对表的序列 1..n（从 1 起连续存在的整数键）原地排序，其他键不受影响。
+//less 缺省时按 operator<；函数 Var 以 {a, b} 调用，a 应排在 b 之前时返回真值。
+//序列较长时 sort 与 stableSort 分段并行排序后归并，此时 less 会被多个线程同时调用。
+//less 不可修改该表；less 抛出异常时异常向外传递，表不变。
+
+void sort(Var const & tbl, std::function<bool(Var const &, Var const &)> const & less = {});
+void sort(Var const & tbl, Var const & less);
+void stableSort(Var const & tbl, std::function<bool(Var const &, Var const &)> const & less = {});
+void stableSort(Var const & tbl, Var const & less);
+//使 1..k 为整个序列中最前的 k 个并有序（top-k），其余顺序未指定
+void partialSort(Var const & tbl, std::size_t k, std::function<bool(Var const &, Var const &)> const & less = {});
+void partialSort(Var const & tbl, std::size_t k, Var const & less);
+//使第 nth 个（从 1 起）为排序后该位置的值，之前的都不在其后，之后的都不在其前
+void nthElement(Var const & tbl, std::size_t nth, std::function<bool(Var const &, Var const &)> const & less = {});
+void nthElement(Var const & tbl, std::size_t nth, Var const & less);
+
+
+#endif
@@ -0,0 +1,131 @@
+﻿#include "ThreadPool.hpp"
+#include <exception>
+using namespace std;
+
+
+namespace
+{
+	//当前线程所属的池及其队列下标
+	thread_local util::ThreadPool const * t_pool = nullptr;
+	thread_local size_t t_self = 0;
+}
+
+
+namespace util
+{
+	ThreadPool::ThreadPool(unsigned nThread)
+	{
+		for (unsigned i = 0; i < nThread || i < 1; ++i)
+			_queues.emplace_back(new Queue);
+		for (unsigned i = 0; i < nThread; ++i)
+			_workers.emplace_back(&ThreadPool::work, this, i);
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			lock_guard<mutex> lg(_m);
+			_stop = true;
+		}
+		_cv.notify_all();
+		for (auto & th : _workers)
+			th.join();
+	}
+
+	ThreadPool & ThreadPool::shared()
+	{
+		static ThreadPool pool([] {
+			auto n = thread::hardware_concurrency();
+			return n > 1 ? n - 1 : 0;
+		}());
+		return pool;
+	}
+
+	void ThreadPool::parallelFor(size_t n, function<void(size_t)> const & body)
+	{
+		if (!n)
+			return;
+
+		struct Group
+		{
+			atomic<size_t>	left;
+			mutex			m;
+			exception_ptr	error;
+		};
+		auto group = make_shared<Group>();
+		group->left = n;
+		for (size_t i = 0; i < n; ++i)
+			push([group, &body, i] {
+				try {
+					body(i);
+				}
+				catch (...) {
+					lock_guard<mutex> lg(group->m);
+					if (!group->error)
+						group->error = current_exception();
+				}
+				--group->left;
+			});
+
+		while (group->left)
+			if (!runOne())
+				this_thread::yield();
+		if (group->error)
+			rethrow_exception(group->error);
+	}
+
+	void ThreadPool::push(task_t && task)
+	{
+		auto i = this == t_pool ? t_self : _next++ % _queues.size();
+		//先计数再入队：取走任务的线程减计数时，计数已含此任务
+		{
+			lock_guard<mutex> lg(_m);
+			++_pending;
+		}
+		{
+			lock_guard<mutex> lg(_queues[i]->m);
+			_queues[i]->tasks.push_back(std::move(task));
+		}
+		_cv.notify_one();
+	}
+
+	bool ThreadPool::runOne()
+	{
+		auto n = _queues.size();
+		auto self = this == t_pool ? t_self : _next % n;
+		task_t task;
+		for (size_t k = 0; k < n && !task; ++k) {
+			auto & q = *_queues[(self + k) % n];
+			lock_guard<mutex> lg(q.m);
+			if (q.tasks.empty())
+				continue;
+			if (k) {
+				task = std::move(q.tasks.front());
+				q.tasks.pop_front();
+			}
+			else {
+				task = std::move(q.tasks.back());
+				q.tasks.pop_back();
+			}
+			--_pending;
+		}
+		if (!task)
+			return false;
+		task();
+		return true;
+	}
+
+	void ThreadPool::work(size_t self)
+	{
+		t_pool = this;
+		t_self = self;
+		for (;;) {
+			if (runOne())
+				continue;
+			unique_lock<mutex> lk(_m);
+			_cv.wait(lk, [this] { return _stop || _pending; });
+			if (_stop && !_pending)
+				return;
+		}
+	}
+}
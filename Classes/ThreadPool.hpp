@@ -0,0 +1,59 @@
+﻿#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace util
+{
+	//工作窃取线程池：线程从自己队列的尾部取任务，空闲时从其他队列的头部窃取
+	class ThreadPool
+	{
+	public:
+		using task_t = std::function<void()>;
+
+		explicit ThreadPool(unsigned nThread);
+		~ThreadPool();
+		ThreadPool(ThreadPool const &)					= delete;
+		ThreadPool & operator=(ThreadPool const &)		= delete;
+
+		//工作线程数为硬件线程数减一，调用线程补足最后一个
+		static ThreadPool & shared();
+		unsigned size()const noexcept					{ return unsigned(_workers.size()); }
+
+		//对 [0, n) 的每个 i 调用 body，阻塞至全部完成，调用线程也参与执行；
+		//可在 body 中嵌套调用。body 抛出的第一个异常在全部完成后重新抛出
+		void parallelFor(std::size_t n, std::function<void(std::size_t)> const & body);
+
+	private:
+		struct Queue
+		{
+			std::mutex			m;
+			std::deque<task_t>	tasks;
+		};
+
+		std::vector<std::unique_ptr<Queue>>	_queues;
+		std::vector<std::thread>			_workers;
+		std::mutex							_m;
+		std::condition_variable				_cv;
+		std::atomic<std::size_t>			_pending{0};
+		std::atomic<std::size_t>			_next{0};
+		bool								_stop = false;
+
+		void push(task_t &&);
+		bool runOne();
+		void work(std::size_t self);
+	};
+}
+
+
+#endif
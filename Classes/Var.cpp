@@ -3,10 +3,24 @@
 #endif // _MSC_VER
 
 #include "Var.hpp"
+#include "Profiler.hpp"
+#include "ThreadPool.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <limits>
+#include <stdexcept>
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define VAR_SIMD_X86
+#define VAR_AVX2 __attribute__((target("avx2")))
+#endif
 using namespace std;
 
 
@@ -16,6 +30,987 @@ decltype(Var::mrcm)	Var::mrcm;
 #define lockGuard(name) std::lock_guard<decltype(Var::mrcm)>name(Var::mrcm)
 
 
+namespace
+{
+	using number_t = Var::number_t;
+	using integer_t = Var::integer_t;
+
+	number_t const k_2p63 = 9223372036854775808.0;
+
+	inline bool isNumber(Var const & v) noexcept
+	{
+		return Var::Type::number == v.type || Var::Type::integer == v.type;
+	}
+
+	inline number_t real(Var const & v) noexcept
+	{
+		return Var::Type::integer == v.type ? number_t(v.i) : v.n;
+	}
+
+	//d 是 int64 范围内的整数时写入 i
+	inline bool integral(number_t d, integer_t & i) noexcept
+	{
+		if (!(d >= -k_2p63 && d < k_2p63))
+			return false;
+		i = integer_t(d);
+		return number_t(i) == d;
+	}
+
+	//整数与浮点数的精确比较：i 小于、等于、大于 d 时返回 -1、0、1，d 为 NaN 时返回 2
+	int compare(integer_t i, number_t d) noexcept
+	{
+		if (d != d)
+			return 2;
+		if (d >= k_2p63)
+			return -1;
+		if (d < -k_2p63)
+			return 1;
+		auto t = integer_t(d);
+		if (i != t)
+			return i < t ? -1 : 1;
+		auto f = d - number_t(t);
+		return f > 0 ? -1 : f < 0 ? 1 : 0;
+	}
+
+	//两个数的大小关系，含义同 compare
+	int order(Var const & a, Var const & b) noexcept
+	{
+		if (Var::Type::integer == a.type && Var::Type::integer == b.type)
+			return a.i < b.i ? -1 : a.i > b.i;
+		if (Var::Type::integer == a.type)
+			return compare(a.i, b.n);
+		if (Var::Type::integer == b.type) {
+			auto r = compare(b.i, a.n);
+			return 2 == r ? r : -r;
+		}
+		return a.n < b.n ? -1 : a.n > b.n ? 1 : a.n == b.n ? 0 : 2;
+	}
+
+	//溢出时返回 false
+	inline bool addExact(integer_t a, integer_t b, integer_t & r) noexcept
+	{
+		r = integer_t(uint64_t(a) + uint64_t(b));
+		return (a < 0) != (b < 0) || (r < 0) == (a < 0);
+	}
+
+	inline bool subExact(integer_t a, integer_t b, integer_t & r) noexcept
+	{
+		r = integer_t(uint64_t(a) - uint64_t(b));
+		return (a < 0) == (b < 0) || (r < 0) == (a < 0);
+	}
+
+	inline bool mulExact(integer_t a, integer_t b, integer_t & r) noexcept
+	{
+#ifdef __GNUC__
+		return !__builtin_mul_overflow(a, b, &r);
+#else
+		r = integer_t(uint64_t(a) * uint64_t(b));
+		return !a || (r / a == b && !(-1 == a && numeric_limits<integer_t>::min() == b));
+#endif
+	}
+
+	enum class ArrayOp : char {
+		add, sub, mul, div, mod, pow
+	};
+	enum class ArrayReduce : char {
+		sum, min, max
+	};
+
+	inline number_t apply(ArrayOp op, number_t a, number_t b)
+	{
+		switch (op) {
+			case ArrayOp::add:
+				return a + b;
+			case ArrayOp::sub:
+				return a - b;
+			case ArrayOp::mul:
+				return a * b;
+			case ArrayOp::div:
+				return a / b;
+			case ArrayOp::mod:
+				return fmod(a, b);
+			default:
+				return pow(a, b);
+		}
+	}
+
+	inline number_t apply(ArrayReduce op, number_t a, number_t b)
+	{
+		switch (op) {
+			case ArrayReduce::sum:
+				return a + b;
+			case ArrayReduce::min:
+				return b < a ? b : a;
+			default:
+				return a < b ? b : a;
+		}
+	}
+
+#ifdef VAR_SIMD_X86
+	//a、b 不是向量时按标量广播；返回已处理的元素个数
+	size_t sse2Binary(ArrayOp op, number_t * r, number_t const * a, bool va, number_t const * b, bool vb, size_t n)
+	{
+		size_t i = 0;
+		__m128d sa = _mm_set1_pd(*a), sb = _mm_set1_pd(*b);
+		for (; i + 2 <= n; i += 2) {
+			__m128d x = va ? _mm_loadu_pd(a + i) : sa;
+			__m128d y = vb ? _mm_loadu_pd(b + i) : sb;
+			switch (op) {
+				case ArrayOp::add:
+					x = _mm_add_pd(x, y);
+					break;
+				case ArrayOp::sub:
+					x = _mm_sub_pd(x, y);
+					break;
+				case ArrayOp::mul:
+					x = _mm_mul_pd(x, y);
+					break;
+				default:
+					x = _mm_div_pd(x, y);
+					break;
+			}
+			_mm_storeu_pd(r + i, x);
+		}
+		return i;
+	}
+
+	VAR_AVX2 size_t avx2Binary(ArrayOp op, number_t * r, number_t const * a, bool va, number_t const * b, bool vb, size_t n)
+	{
+		size_t i = 0;
+		__m256d sa = _mm256_set1_pd(*a), sb = _mm256_set1_pd(*b);
+		for (; i + 4 <= n; i += 4) {
+			__m256d x = va ? _mm256_loadu_pd(a + i) : sa;
+			__m256d y = vb ? _mm256_loadu_pd(b + i) : sb;
+			switch (op) {
+				case ArrayOp::add:
+					x = _mm256_add_pd(x, y);
+					break;
+				case ArrayOp::sub:
+					x = _mm256_sub_pd(x, y);
+					break;
+				case ArrayOp::mul:
+					x = _mm256_mul_pd(x, y);
+					break;
+				default:
+					x = _mm256_div_pd(x, y);
+					break;
+			}
+			_mm256_storeu_pd(r + i, x);
+		}
+		return i;
+	}
+
+	//n >= 1；acc 为前若干元素的部分结果
+	size_t sse2Reduce(ArrayReduce op, number_t const * p, size_t n, number_t & acc)
+	{
+		size_t i = 0;
+		__m128d x = ArrayReduce::sum == op ? _mm_setzero_pd() : _mm_set1_pd(*p);
+		for (; i + 2 <= n; i += 2) {
+			__m128d y = _mm_loadu_pd(p + i);
+			switch (op) {
+				case ArrayReduce::sum:
+					x = _mm_add_pd(x, y);
+					break;
+				case ArrayReduce::min:
+					x = _mm_min_pd(x, y);
+					break;
+				default:
+					x = _mm_max_pd(x, y);
+					break;
+			}
+		}
+		alignas(16) number_t lane[2];
+		_mm_store_pd(lane, x);
+		acc = apply(op, lane[0], lane[1]);
+		return i;
+	}
+
+	VAR_AVX2 size_t avx2Reduce(ArrayReduce op, number_t const * p, size_t n, number_t & acc)
+	{
+		size_t i = 0;
+		__m256d x = ArrayReduce::sum == op ? _mm256_setzero_pd() : _mm256_set1_pd(*p);
+		for (; i + 4 <= n; i += 4) {
+			__m256d y = _mm256_loadu_pd(p + i);
+			switch (op) {
+				case ArrayReduce::sum:
+					x = _mm256_add_pd(x, y);
+					break;
+				case ArrayReduce::min:
+					x = _mm256_min_pd(x, y);
+					break;
+				default:
+					x = _mm256_max_pd(x, y);
+					break;
+			}
+		}
+		alignas(32) number_t lane[4];
+		_mm256_store_pd(lane, x);
+		acc = apply(op, apply(op, lane[0], lane[1]), apply(op, lane[2], lane[3]));
+		return i;
+	}
+
+	size_t sse2Dot(number_t const * a, number_t const * b, size_t n, number_t & acc)
+	{
+		size_t i = 0;
+		__m128d x = _mm_setzero_pd();
+		for (; i + 2 <= n; i += 2)
+			x = _mm_add_pd(x, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+		alignas(16) number_t lane[2];
+		_mm_store_pd(lane, x);
+		acc = lane[0] + lane[1];
+		return i;
+	}
+
+	VAR_AVX2 size_t avx2Dot(number_t const * a, number_t const * b, size_t n, number_t & acc)
+	{
+		size_t i = 0;
+		__m256d x = _mm256_setzero_pd();
+		for (; i + 4 <= n; i += 4)
+			x = _mm256_add_pd(x, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+		alignas(32) number_t lane[4];
+		_mm256_store_pd(lane, x);
+		acc = (lane[0] + lane[1]) + (lane[2] + lane[3]);
+		return i;
+	}
+#endif
+
+	void arrayBinary(ArrayOp op, number_t * r, number_t const * a, bool va, number_t const * b, bool vb, size_t n)
+	{
+		if (!n)
+			return;
+		size_t i = 0;
+#ifdef VAR_SIMD_X86
+		if (op < ArrayOp::mod)
+			i = util::HasAVX2() ? avx2Binary(op, r, a, va, b, vb, n) : sse2Binary(op, r, a, va, b, vb, n);
+#endif
+		for (; i < n; ++i)
+			r[i] = apply(op, a[va ? i : 0], b[vb ? i : 0]);
+	}
+
+	number_t arrayReduce(ArrayReduce op, number_t const * p, size_t n)
+	{
+		number_t acc = ArrayReduce::sum == op ? 0 : *p;
+		size_t i = 0;
+#ifdef VAR_SIMD_X86
+		i = util::HasAVX2() ? avx2Reduce(op, p, n, acc) : sse2Reduce(op, p, n, acc);
+#endif
+		for (; i < n; ++i)
+			acc = apply(op, acc, p[i]);
+		return acc;
+	}
+
+	number_t arrayDot(number_t const * a, number_t const * b, size_t n)
+	{
+		number_t acc = 0;
+		size_t i = 0;
+#ifdef VAR_SIMD_X86
+		i = util::HasAVX2() ? avx2Dot(a, b, n, acc) : sse2Dot(a, b, n, acc);
+#endif
+		for (; i < n; ++i)
+			acc += a[i] * b[i];
+		return acc;
+	}
+
+	Var::Result<> arrayArith(ArrayOp op, Var const & lhs, Var const & rhs)
+	{
+		!lhs, !rhs;
+		bool va = Var::Type::array == lhs.type, vb = Var::Type::array == rhs.type;
+		if ((!va && !isNumber(lhs)) || (!vb && !isNumber(rhs)))
+			return Var::Errc::type;
+
+		auto n = va ? lhs.a->size() : rhs.a->size();
+		if (va && vb && rhs.a->size() != n)
+			return Var::Errc::size;
+		number_t x = va ? 0 : real(lhs), y = vb ? 0 : real(rhs);
+		Var rtn = Var::array(n);
+		arrayBinary(op, rtn.a->data(), va ? lhs.a->data() : &x, va, vb ? rhs.a->data() : &y, vb, n);
+		return rtn;
+	}
+
+	//整数运算：溢出、除不尽或除以 0 时按浮点数计算
+	Var integerArith(ArrayOp op, integer_t a, integer_t b)
+	{
+		integer_t r;
+		switch (op) {
+			case ArrayOp::add:
+				if (addExact(a, b, r))
+					return r;
+				break;
+			case ArrayOp::sub:
+				if (subExact(a, b, r))
+					return r;
+				break;
+			case ArrayOp::mul:
+				if (mulExact(a, b, r))
+					return r;
+				break;
+			case ArrayOp::div:
+				if (-1 == b && numeric_limits<integer_t>::min() != a)
+					return -a;
+				if (b && -1 != b && !(a % b))
+					return a / b;
+				break;
+			case ArrayOp::mod:
+				if (b)
+					return -1 == b ? 0 : a % b;
+				break;
+			default:
+				break;
+		}
+		return apply(op, number_t(a), number_t(b));
+	}
+
+	Var::Result<> arith(ArrayOp op, Var const & lhs, Var const & rhs)
+	{
+		if (Var::Type::lazy == lhs.type || Var::Type::lazy == rhs.type)
+			return arith(op, lhs.force(), rhs.force());
+		if (Var::Type::integer == lhs.type && Var::Type::integer == rhs.type)
+			return integerArith(op, lhs.i, rhs.i);
+		if (isNumber(lhs) && isNumber(rhs))
+			return Var(apply(op, real(lhs), real(rhs)));
+		if (Var::Type::array == lhs.type || Var::Type::array == rhs.type)
+			return arrayArith(op, lhs, rhs);
+		return Var::Errc::type;
+	}
+
+	//整数文本解析为 integer，其余按 atof
+	Var parseNumber(char const * p)
+	{
+		char * end;
+		errno = 0;
+		auto i = strtoll(p, &end, 10);
+		if (end != p && !*end && !errno)
+			return integer_t(i);
+		return atof(p);
+	}
+
+	//不以 0 结尾的文本，短文本复制到栈上
+	Var parseNumber(char const * p, size_t n)
+	{
+		char buf[128];
+		if (n >= sizeof(buf))
+			return parseNumber(string(p, n).c_str());
+		memcpy(buf, p, n);
+		buf[n] = '\0';
+		return parseNumber(buf);
+	}
+
+	//把 try* 的失败转换为异常
+	Var check(Var::Result<> && r, Var const & lhs, Var const & rhs, char const * func)
+	{
+		if (r)
+			return std::move(r.value);
+		if (Var::Errc::size == r.error)
+			throw length_error(string("Call ")+func+" with arrays of different sizes");
+		throw Var::TypeError(lhs.type, rhs.type, func);
+	}
+
+	Var adopt(Var::bytes_t * y, Var::Type type)
+	{
+		Var rtn;
+		rtn.y = y;
+		rtn.type = type;
+		rtn.strong = true;
+		lockGuard(lg);
+		Var::mrc.emplace(y, 1);
+		return rtn;
+	}
+
+	bool textOf(Var const & var, char const *& p, size_t & n) noexcept
+	{
+		switch (var.type) {
+			case Var::Type::string:
+				p = var.s->data();
+				n = var.s->size();
+				return true;
+			case Var::Type::strview:
+				p = var.y->data;
+				n = var.y->size;
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	int textCompare(char const * p, size_t n, char const * q, size_t m) noexcept
+	{
+		auto r = memcmp(p, q, n < m ? n : m);
+		return r ? r : n < m ? -1 : n > m;
+	}
+
+	size_t const k_sweepStep = 2;
+	size_t const k_sweepBatch = 64;
+	size_t const k_logSlack = 16;
+	size_t const k_parallelMin = 1024;
+
+	atomic<uint64_t> g_version{0};
+
+	inline bool weakable(Var::Type type) noexcept
+	{
+		return Var::Type::function == type || Var::Type::closure == type
+			|| Var::Type::table == type || Var::Type::array == type;
+	}
+
+	inline Var invoke(Var const & fn, Var args)
+	{
+		Profiler::Scope scope(Var::Type::native == fn.type ? reinterpret_cast<void const *>(fn.p) : fn.t);
+		if (Var::Type::native == fn.type)
+			return fn.p(std::move(args));
+		if (Var::Type::closure == fn.type)
+			return fn.c->invoke(fn.c->data, std::move(args));
+		return (*fn.f)(std::move(args));
+	}
+
+	inline bool isDeadKey(Var const & k)
+	{
+		return !k.strong && weakable(k.type) && !Var::mrc.count(k.t);
+	}
+
+	//表被修改：版本递增，释放缓存的哈希
+	void touch(Var::table_t & t)
+	{
+		t.version.fetch_add(1, memory_order_release);
+		if (t.hashed.exchange(false))
+			atomic_store(&t.hash, shared_ptr<Var::table_t::hash_t const>());
+	}
+
+	//从 sweepAt 起清扫 n 个桶，返回清除的项数；须持有 mrcm
+	size_t sweepBuckets(Var::table_t & t, size_t n)
+	{
+		size_t nErased = 0;
+		vector<Var const*> dead;
+		for (; n && t.nWeakKey; --n) {
+			if (t.sweepAt >= t.bucket_count()) {
+				t.sweepAt = 0;
+				if (t.size() * 4 < t.bucket_count())
+					t.rehash(0);
+			}
+			auto b = t.sweepAt++;
+			for (auto it = t.begin(b); it != t.end(b); ++it)
+				if (isDeadKey(it->first))
+					dead.push_back(&it->first);
+			for (auto k : dead)
+				t.erase(t.find(*k));
+			if (!dead.empty())
+				touch(t);
+			nErased += dead.size();
+			t.nWeakKey -= dead.size() < t.nWeakKey ? dead.size() : t.nWeakKey;
+			dead.clear();
+		}
+		return nErased;
+	}
+
+	//日志中已被覆盖的项超过一半时重建，同时丢弃死亡的弱键
+	void compact(Var::table_t::changes_t & c)
+	{
+		c.log.clear();
+		for (auto it = c.latest.begin(); it != c.latest.end();) {
+			if (isDeadKey(it->first)) {
+				it = c.latest.erase(it);
+			} else {
+				c.log.emplace_back(it->second, &it->first);
+				++it;
+			}
+		}
+		sort(c.log.begin(), c.log.end());
+	}
+
+	//复制键，弱键的副本仍为弱引用
+	Var keep(Var const & k)
+	{
+		Var key(k);
+		if (!k.strong)
+			key.setWeak();
+		return key;
+	}
+
+	void record(Var::table_t & t, Var const & k)
+	{
+		auto & c = *t.changes;
+		auto it = c.latest.find(k);
+		if (c.latest.end() == it)
+			it = c.latest.emplace(keep(k), 0).first;
+		c.log.emplace_back(it->second = ++g_version, &it->first);
+		if (c.log.size() > c.latest.size() * 2 + k_logSlack)
+			compact(c);
+	}
+
+	//写入用的槽，键不存在时插入；只用于赋值与交换，读不经此处
+	Var & slot(Var::table_t & t, Var && k)
+	{
+		if (t.nWeakKey) {
+			lockGuard(lg);
+			sweepBuckets(t, k_sweepStep);
+		}
+		if (!k.strong && weakable(k.type))
+			++t.nWeakKey;
+		if (t.changes)
+			record(t, k);
+		touch(t);
+		return t[std::move(k)];
+	}
+
+	void trackNested(Var::table_t & t, Var const & k, Var const & v)
+	{
+		if (Var::Type::table == v.type && v && !isDeadKey(k)) {
+			v.track();
+			t.changes->nested.insert(keep(k));
+		}
+	}
+
+	void addTo(Var & tbl, Var const & k, Var const & v)
+	{
+		if (!tbl)
+			tbl = Var::table();
+		tbl[k] = v;
+	}
+
+	//把 t 在 since 之后的修改写入 patch，返回是否有修改；seen 防止环与重复
+	bool diffInto(Var::table_t & t, uint64_t since, Var const & patch, unordered_set<void const*> & seen)
+	{
+		if (!t.changes || !seen.insert(&t).second)
+			return false;
+
+		auto & c = *t.changes;
+		Var assigned, erased, nested;
+		auto first = lower_bound(c.log.begin(), c.log.end(), since + 1,
+			[](pair<uint64_t, Var const*> const & e, uint64_t v) { return e.first < v; });
+		for (auto it = first; it != c.log.end(); ++it) {
+			auto & k = *it->second;
+			if (c.latest.find(k)->second != it->first || isDeadKey(k))
+				continue;
+			auto v = t.find(k);
+			if (t.end() == v) {
+				addTo(erased, k, true);
+			} else {
+				addTo(assigned, k, v->second);
+				trackNested(t, k, v->second);
+			}
+		}
+		for (auto it = c.nested.begin(); it != c.nested.end();) {
+			auto v = t.find(*it);
+			if (isDeadKey(*it) || t.end() == v || Var::Type::table != v->second.type || !v->second) {
+				it = c.nested.erase(it);
+				continue;
+			}
+			if (!assigned || !assigned.contains(*it)) {
+				Var sub = Var::table();
+				if (diffInto(*v->second.t, since, sub, seen))
+					addTo(nested, *it, sub);
+			}
+			++it;
+		}
+
+		if (assigned)
+			patch["set"] = assigned;
+		if (erased)
+			patch["erase"] = erased;
+		if (nested)
+			patch["nested"] = nested;
+		return assigned || erased || nested;
+	}
+
+	//表与数组深复制，copies 保持共享与环
+	Var cloneOf(Var const & v, unordered_map<void const*, Var> & copies)
+	{
+		if (!v.strong && weakable(v.type))
+			return keep(v);
+		switch (v.type) {
+			case Var::Type::array:
+				return Var::array(Var::array_t(*v.a));
+			case Var::Type::table:{
+				auto it = copies.find(v.t);
+				if (copies.end() != it)
+					return it->second;
+				auto rtn = Var::table();
+				auto & dst = *rtn.t;
+				dst.reserve(v.t->size());
+				copies.emplace(v.t, rtn);
+				for (auto & pair : *v.t) {
+					if (isDeadKey(pair.first))
+						continue;
+					if (!pair.first.strong && weakable(pair.first.type))
+						++dst.nWeakKey;
+					dst.emplace(keep(pair.first), cloneOf(pair.second, copies));
+				}
+				return rtn;
+			}
+			default:
+				return v;
+		}
+	}
+
+	size_t mix(size_t h) noexcept
+	{
+		h ^= h >> 31;
+		h *= size_t(0x9e3779b97f4a7c15ull);
+		return h ^ h >> 29;
+	}
+
+	size_t structHash(Var const & v, vector<Var::table_t const*> & path, size_t & low);
+
+	using children_t = vector<pair<Var, uint64_t>>;
+
+	//children 收集值为表的项及其计算前的版本；弱引用的值可能失效，数组没有版本号，含它们的表不缓存
+	size_t entriesHash(Var::table_t const & t, size_t first, size_t last, vector<Var::table_t const*> & path, size_t & low, children_t & children)
+	{
+		size_t h = 0;
+		for (auto b = first; b < last; ++b)
+			for (auto it = t.begin(b); it != t.end(b); ++it) {
+				auto & v = it->second.force();
+				if ((!v.strong && weakable(v.type)) || Var::Type::array == v.type)
+					low = 0;
+				else if (Var::Type::table == v.type)
+					children.emplace_back(v, v.t->version.load(memory_order_acquire));
+				h += mix(hash<Var>{}(it->first) * 31 + structHash(v, path, low));
+			}
+		return h;
+	}
+
+	//缓存有效：本表与缓存时的各子表都未再修改
+	bool cachedHash(Var::table_t const & t, size_t & h)
+	{
+		if (!t.hashed.load(memory_order_acquire))
+			return false;
+		auto c = atomic_load(&t.hash);
+		if (!c || c->version != t.version.load(memory_order_acquire))
+			return false;
+		size_t sub;
+		for (auto & child : c->children)
+			if (child.first.t->version.load(memory_order_acquire) != child.second || !cachedHash(*child.first.t, sub))
+				return false;
+		h = c->value;
+		return true;
+	}
+
+	//path 为正在计算的祖先，low 为遇到的最浅回边；回边以常量代替，含环的子表不缓存
+	size_t tableHash(Var::table_t & t, vector<Var::table_t const*> & path, size_t & low)
+	{
+		size_t h;
+		if (cachedHash(t, h))
+			return h;
+		auto cycle = find(path.begin(), path.end(), &t);
+		if (path.end() != cycle) {
+			low = min(low, size_t(cycle - path.begin()));
+			return mix(path.size());
+		}
+
+		auto version = t.version.load(memory_order_acquire);
+		auto nBucket = t.bucket_count();
+		h = mix(t.size());
+		size_t subLow = SIZE_MAX;
+		children_t children;
+		path.push_back(&t);
+		if (t.size() < k_parallelMin) {
+			h += entriesHash(t, 0, nBucket, path, subLow, children);
+		} else {
+			auto nChunk = min(nBucket, size_t(util::ThreadPool::shared().size() + 1) * 4);
+			vector<size_t> parts(nChunk), lows(nChunk, SIZE_MAX);
+			vector<children_t> subs(nChunk);
+			util::ThreadPool::shared().parallelFor(nChunk, [&](size_t i) {
+				auto local = path;
+				parts[i] = entriesHash(t, nBucket * i / nChunk, nBucket * (i + 1) / nChunk, local, lows[i], subs[i]);
+			});
+			for (size_t i = 0; i < nChunk; ++i) {
+				h += parts[i];
+				subLow = min(subLow, lows[i]);
+				move(subs[i].begin(), subs[i].end(), back_inserter(children));
+			}
+		}
+		path.pop_back();
+
+		if (SIZE_MAX == subLow) {
+			auto c = make_shared<Var::table_t::hash_t>();
+			c->value = h;
+			c->version = version;
+			c->children = std::move(children);
+			atomic_store(&t.hash, shared_ptr<Var::table_t::hash_t const>(std::move(c)));
+			t.hashed.store(true, memory_order_release);
+		}
+		low = min(low, subLow);
+		return h;
+	}
+
+	size_t structHash(Var const & v, vector<Var::table_t const*> & path, size_t & low)
+	{
+		if (Var::Type::lazy == v.type)
+			return structHash(v.force(), path, low);
+		//弱引用：持有 mrcm 检查存活并取强引用，不改写共享的 v（可能在线程池中计算）
+		if (!v.strong && weakable(v.type)) {
+			Var hold;
+			{
+				lockGuard(lg);
+				if (Var::mrc.count(v.t))
+					hold = Var(v);
+			}
+			return structHash(hold, path, low);
+		}
+		switch (v.type) {
+			case Var::Type::array:{
+				auto h = mix(v.a->size());
+				for (auto n : *v.a)
+					h = mix(h * 31 + hash<Var::number_t>{}(n));
+				return h;
+			}
+			case Var::Type::table:
+				return tableHash(*v.t, path, low);
+			default:
+				return hash<Var>{}(v);
+		}
+	}
+
+	bool cachedDiffer(Var::table_t const & a, Var::table_t const & b)
+	{
+		size_t ha, hb;
+		return cachedHash(a, ha) && cachedHash(b, hb) && ha != hb;
+	}
+
+	//assumed 为正在比较的表对，环上再次遇到时视为相等
+	bool structEqual(Var const & a, Var const & b, vector<pair<void const*, void const*>> & assumed)
+	{
+		if (Var::Type::lazy == a.type || Var::Type::lazy == b.type)
+			return structEqual(a.force(), b.force(), assumed);
+		!a, !b;
+		if (Var::Type::array == a.type && Var::Type::array == b.type)
+			return *a.a == *b.a;
+		if (Var::Type::table != a.type || Var::Type::table != b.type)
+			return equal_to<Var>{}(a, b);
+		if (a.t == b.t)
+			return true;
+		if (a.t->size() != b.t->size() || cachedDiffer(*a.t, *b.t))
+			return false;
+		auto ab = make_pair((void const*)a.t, (void const*)b.t);
+		if (assumed.end() != find(assumed.begin(), assumed.end(), ab))
+			return true;
+
+		assumed.push_back(ab);
+		for (auto & pair : *a.t) {
+			auto it = b.t->find(pair.first);
+			if (b.t->end() == it || !structEqual(pair.second, it->second, assumed)) {
+				assumed.pop_back();
+				return false;
+			}
+		}
+		assumed.pop_back();
+		return true;
+	}
+
+	struct Canonical
+	{
+		mutex m;
+		unordered_set<Var> strings;
+	};
+
+	Canonical & canonical()
+	{
+		static Canonical s_canonical;
+		return s_canonical;
+	}
+
+	//字符串换成池中的同一份；表复制一份，copies 保持共享与环，原表不动
+	Var canonOf(Var const & v, Canonical & pool, unordered_map<void const*, Var> & copies)
+	{
+		if (Var::Type::lazy == v.type)
+			return canonOf(v.force(), pool, copies);
+		!v;
+		if (!v.strong && weakable(v.type))
+			return keep(v);
+		switch (v.type) {
+			case Var::Type::string:
+				return *pool.strings.insert(v).first;
+			case Var::Type::array:
+				return cloneOf(v, copies);
+			case Var::Type::table:{
+				auto it = copies.find(v.t);
+				if (copies.end() != it)
+					return it->second;
+				auto rtn = Var::table();
+				auto & dst = *rtn.t;
+				dst.reserve(v.t->size());
+				copies.emplace(v.t, rtn);
+				for (auto & pair : *v.t) {
+					if (isDeadKey(pair.first))
+						continue;
+					if (!pair.first.strong && weakable(pair.first.type))
+						++dst.nWeakKey;
+					auto key = Var::Type::string == pair.first.type ? *pool.strings.insert(pair.first).first : keep(pair.first);
+					dst.emplace(key, canonOf(pair.second, pool, copies));
+				}
+				return rtn;
+			}
+			default:
+				return v;
+		}
+	}
+
+	void applyPatch(Var const & dst, Var const & patch, unordered_map<void const*, Var> & copies)
+	{
+		if (auto p = patch.find("erase"))
+			for (auto & pair : *p)
+				dst.erase(pair.first);
+		if (auto p = patch.find("set"))
+			for (auto & pair : *p)
+				dst[pair.first] = cloneOf(pair.second, copies);
+		if (auto p = patch.find("nested"))
+			for (auto & pair : *p) {
+				auto q = dst.find(pair.first);
+				if (!q)
+					throw Var::TypeError(Var::Type::nil, "apply");
+				applyPatch(*q, pair.second, copies);
+			}
+	}
+
+	atomic<size_t> g_releaseAt{0};
+
+	//后台析构大表；对象析构时先关闭延迟，再析构余下的表
+	class Reclaimer
+	{
+		mutex _m;
+		condition_variable _cv, _idle;
+		deque<Var::table_t*> _queue;
+		atomic<size_t> _depth{0};
+		bool _stop = false;
+		thread _worker;
+
+		void run()
+		{
+			unique_lock<mutex> lk(_m);
+			for (;;) {
+				_cv.wait(lk, [this]{ return _stop || !_queue.empty(); });
+				if (_queue.empty())
+					return;
+				auto t = _queue.front();
+				_queue.pop_front();
+				lk.unlock();
+				delete t;
+				lk.lock();
+				if (!--_depth)
+					_idle.notify_all();
+			}
+		}
+
+	public:
+		static Reclaimer & shared()
+		{
+			static Reclaimer s_reclaimer;
+			return s_reclaimer;
+		}
+
+		~Reclaimer()
+		{
+			g_releaseAt = 0;
+			{
+				lock_guard<mutex> lg(_m);
+				_stop = true;
+			}
+			_cv.notify_all();
+			if (_worker.joinable())
+				_worker.join();
+			flush();
+		}
+
+		size_t depth()const noexcept		{ return _depth; }
+
+		void push(Var::table_t * t)
+		{
+			lock_guard<mutex> lg(_m);
+			//先起线程再入队：起线程失败时表仍由调用者析构
+			if (!_stop && !_worker.joinable())
+				_worker = thread(&Reclaimer::run, this);
+			_queue.push_back(t);
+			++_depth;
+			_cv.notify_one();
+		}
+
+		void flush()
+		{
+			unique_lock<mutex> lk(_m);
+			if (_worker.joinable()) {
+				_idle.wait(lk, [this]{ return !_depth; });
+				return;
+			}
+			while (!_queue.empty()) {
+				auto t = _queue.front();
+				_queue.pop_front();
+				lk.unlock();
+				delete t;
+				lk.lock();
+				--_depth;
+			}
+		}
+	};
+
+	//表够大时交给后台线程析构
+	bool deferDelete(Var const & var) noexcept
+	{
+		auto at = g_releaseAt.load(memory_order_relaxed);
+		if (!at || Var::Type::table != var.type || var.t->size() < at)
+			return false;
+		try {
+			Reclaimer::shared().push(var.t);
+			return true;
+		} catch (...) {
+			return false;
+		}
+	}
+
+	void deletePayload(Var const & var) noexcept
+	{
+		switch (var.type) {
+			case Var::Type::string:
+				delete var.s;
+				break;
+			case Var::Type::function:
+				delete var.f;
+				break;
+			case Var::Type::closure:
+				delete var.c;
+				break;
+			case Var::Type::lazy:
+				delete var.l;
+				break;
+			case Var::Type::table:
+				delete var.t;
+				break;
+			case Var::Type::array:
+				delete var.a;
+				break;
+			case Var::Type::bytes:
+			case Var::Type::strview:
+				delete var.y;
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+
+bool std::equal_to<Var>::operator()(Var const & lhs, Var const & rhs)const noexcept
+{
+	char const *p, *q;
+	size_t n, m;
+	if (textOf(lhs, p, n) && textOf(rhs, q, m))
+		return n == m && (p == q || !memcmp(p, q, n));
+	if (lhs.type != rhs.type)
+		return isNumber(lhs) && isNumber(rhs) && !order(lhs, rhs);
+
+	switch (rhs.type) {
+		case Var::Type::nil:
+			return true;
+		case Var::Type::boolean:
+			return lhs.b == rhs.b;
+		case Var::Type::number:
+			return lhs.n == rhs.n;
+		case Var::Type::integer:
+			return lhs.i == rhs.i;
+		case Var::Type::bytes:
+			return lhs.y == rhs.y || (lhs.y->size == rhs.y->size && !memcmp(lhs.y->data, rhs.y->data, rhs.y->size));
+		default:
+			return lhs.t == rhs.t;
+	}
+}
+
 size_t std::hash<Var>::operator()(Var const & var)const noexcept
 {
 	switch (var.type) {
@@ -23,8 +1018,19 @@ size_t std::hash<Var>::operator()(Var const & var)const noexcept
 			return hash<void*>{}(nullptr);
 		case Var::Type::boolean:
 			return hash<Var::bool_t>{}(var.b);
-		case Var::Type::number:
+		case Var::Type::number:{
+			integer_t i;
+			if (integral(var.n, i))
+				return hash<integer_t>{}(i);
 			return hash<Var::number_t>{}(var.n);
+		}
+		case Var::Type::integer:
+			return hash<integer_t>{}(var.i);
+		case Var::Type::string:
+			return util::HashBytes(var.s->data(), var.s->size());
+		case Var::Type::bytes:
+		case Var::Type::strview:
+			return util::HashBytes(var.y->data, var.y->size);
 		default:
 			return hash<void*>{}(var.t);
 	}
@@ -39,17 +1045,27 @@ string Var::TypeName(Type type) noexcept
 		case Type::boolean:
 			return "boolean";
 		case Type::number:
+		case Type::integer:
 			return "number";
 		case Type::string:
+		case Type::strview:
 			return "string";
 		case Type::function:
+		case Type::native:
+		case Type::closure:
 			return "function";
 		case Type::table:
 			return "table";
+		case Type::array:
+			return "array";
+		case Type::bytes:
+			return "bytes";
+		case Type::lazy:
+			return "lazy";
 	}
 }
 
-Var::Var(char const * val)
+Var::BasicVar(char const * val)
 	: s(new string{val})
 	, type(Type::string)
 	, strong(true)
@@ -58,7 +1074,7 @@ Var::Var(char const * val)
 	mrc.emplace(s, 1);
 }
 
-Var::Var(string && val)
+Var::BasicVar(string && val)
 	: s(new string{std::move(val)})
 	, type(Type::string)
 	, strong(true)
@@ -67,7 +1083,7 @@ Var::Var(string && val)
 	mrc.emplace(s, 1);
 }
 
-Var::Var(string const & val)
+Var::BasicVar(string const & val)
 	: s(new string{val})
 	, type(Type::string)
 	, strong(true)
@@ -89,6 +1105,27 @@ Var Var::function(function_t & val)
 	return std::move(rtn);
 }
 
+Var Var::function(native_t val) noexcept
+{
+	Var rtn;
+	if (val) {
+		rtn.p = val;
+		rtn.type = Type::native;
+	}
+	return rtn;
+}
+
+Var Var::closure_t::wrap(closure_t * c)
+{
+	Var rtn;
+	rtn.c = c;
+	rtn.type = Type::closure;
+	rtn.strong = true;
+	lockGuard(lg);
+	mrc.emplace(c, 1);
+	return rtn;
+}
+
 Var Var::table()
 {
 	Var rtn;
@@ -102,20 +1139,100 @@ Var Var::table()
 	return std::move(rtn);
 }
 
-Var::Var(initializer_list<Var> il)
+Var Var::array(size_t n, number_t val)
+{
+	return array(array_t(n, val));
+}
+
+Var Var::array(initializer_list<number_t> il)
+{
+	return array(array_t(il));
+}
+
+Var Var::array(array_t && val)
+{
+	Var rtn;
+	rtn.a = new array_t(std::move(val));
+	rtn.type = Type::array;
+	rtn.strong = true;
+	{
+		lockGuard(lg);
+		mrc.emplace(rtn.a, 1);
+	}
+	return rtn;
+}
+
+Var Var::bytes(void const * p, size_t n)
+{
+	return bytes(string(static_cast<char const*>(p), n));
+}
+
+Var Var::bytes(void const * p, size_t n, std::function<void()> release)
+{
+	auto y = new bytes_t;
+	y->data = static_cast<char const*>(p);
+	y->size = n;
+	y->release = std::move(release);
+	return adopt(y, Type::bytes);
+}
+
+Var Var::bytes(string && val)
+{
+	auto y = new bytes_t;
+	y->buffer = std::move(val);
+	y->data = y->buffer.data();
+	y->size = y->buffer.size();
+	return adopt(y, Type::bytes);
+}
+
+Var Var::view(char const * p, size_t n, std::function<void()> release)
+{
+	auto y = new bytes_t;
+	y->data = p;
+	y->size = n;
+	y->release = std::move(release);
+	return adopt(y, Type::strview);
+}
+
+Var Var::lazy(std::function<Var()> fn)
+{
+	Var rtn;
+	if (!fn)
+		return rtn;
+	rtn.l = new lazy_t;
+	rtn.l->fn = std::move(fn);
+	rtn.type = Type::lazy;
+	rtn.strong = true;
+	lockGuard(lg);
+	mrc.emplace(rtn.l, 1);
+	return rtn;
+}
+
+Var::BasicVar(unsigned long long val) noexcept
+{
+	if (val > (unsigned long long)numeric_limits<integer_t>::max()) {
+		n = number_t(val);
+		type = Type::number;
+	} else {
+		i = integer_t(val);
+		type = Type::integer;
+	}
+}
+
+Var::BasicVar(initializer_list<Var> il)
 	: t(new table_t{il.size()})
 	, type(Type::table)
 	, strong(true)
 {
 	auto k = 1;
 	for (auto & v : il)
-		if (v != nil)
+		if (Type::lazy == v.type || v != nil)	//不触及惰性值：求得 nil 的惰性元素照样占位
 			t->emplace(k++, v);
 	lockGuard(lg);
 	mrc.emplace(t, 1);
 }
 
-Var::~Var() noexcept
+Var::~BasicVar() noexcept
 {
 	if (strong) {
 		lockGuard(lg);
@@ -127,29 +1244,43 @@ Var::~Var() noexcept
 	else {
 		return;
 	}
-	switch (type) {
-		case Type::string:
-			delete s;
-			break;
-		case Type::function:
-			delete f;
-			break;
-		case Type::table:
-			delete t;
-			break;
-		default:
-			break;
-	}
+	if (!deferDelete(*this))
+		deletePayload(*this);
+}
+
+void Var::deferRelease(size_t minSize) noexcept
+{
+	g_releaseAt = minSize;
+}
+
+size_t Var::pendingRelease() noexcept
+{
+	return Reclaimer::shared().depth();
 }
 
-Var::Var(Var const & rhs)
+void Var::flushRelease()
 {
+	Reclaimer::shared().flush();
+}
+
+Var::BasicVar(Var const & rhs)
+{
+	if (Type::strview == rhs.type && !rhs.strong) {
+		Var val(string(rhs.y->data, rhs.y->size));
+		swap(val);
+		return;
+	}
 	switch (rhs.type) {
 		case Type::string:
 		case Type::function:
-		case Type::table:{
+		case Type::closure:
+		case Type::table:
+		case Type::array:
+		case Type::bytes:
+		case Type::strview:
+		case Type::lazy:{
 			lockGuard(lg);
-			if (rhs) {
+			if (Type::lazy == rhs.type || rhs) {
 				++mrc[t = rhs.t];
 				type = rhs.type;
 				strong = true;
@@ -164,6 +1295,8 @@ Var::Var(Var const & rhs)
 
 Var & Var::operator=(Var const & rhs)
 {
+	if (Type::strview == rhs.type && !rhs.strong)
+		return *this = Var(rhs);
 	if (this != &rhs) {
 		if (rhs.strong) {
 			lockGuard(lg);
@@ -176,7 +1309,7 @@ Var & Var::operator=(Var const & rhs)
 	return *this;
 }
 
-Var::Var(Var && rhs) noexcept
+Var::BasicVar(Var && rhs) noexcept
 {
 	memcpy(this, &rhs, sizeof(Var));
 	new(&rhs)Var;
@@ -192,18 +1325,26 @@ void Var::swap(Var & rhs) noexcept
 	memcpy(&rhs, &mem, sizeof(Var));
 }
 
-Var::operator bool()const noexcept
+Var::operator bool()const
 {
 	switch (type) {
 		case Type::nil:
 			return false;
 		case Type::boolean:
 			return b;
+		case Type::lazy:
+			return (bool)force();
 		case Type::function:
+		case Type::closure:
 		case Type::table:
-			if (!strong && !mrc.count(t)) {
-				type = Type::nil;
-				return false;
+		case Type::array:
+		case Type::bytes:
+			if (!strong) {
+				lockGuard(lg);
+				if (!mrc.count(t)) {
+					type = Type::nil;
+					return false;
+				}
 			}
 		default:
 			return true;
@@ -212,68 +1353,204 @@ Var::operator bool()const noexcept
 
 Var Var::operator-()const
 {
+	if (Type::lazy == type)
+		return -force();
 	if (Type::number == type)
 		return -n;
+	if (Type::integer == type)
+		return numeric_limits<integer_t>::min() != i ? Var(-i) : Var(-number_t(i));
+	if (Type::array == type && *this) {
+		number_t k = -1;
+		Var rtn = array(a->size());
+		arrayBinary(ArrayOp::mul, rtn.a->data(), a->data(), true, &k, false, a->size());
+		return rtn;
+	}
+	throw TypeError(type, __FUNCTION__);
+}
+
+Var Var::operator()(Var const & args)const
+{
+	if (Type::lazy == type)
+		return force()(args);
+	if (Type::native == type)
+		return invoke(*this, args);
+	if (Type::function != type && Type::closure != type)
+		throw TypeError(type, __FUNCTION__);
+	if (strong)
+		return invoke(*this, args);
+	lockGuard(lg);
+	if (*this)
+		return invoke(*this, args);
+	throw TypeError(type, __FUNCTION__);
+}
+
+auto Var::tryCall(Var const & args)const -> Result<>
+{
+	if (Type::lazy == type)
+		return force().tryCall(args);
+	if (Type::native == type)
+		return invoke(*this, args);
+	if (Type::function != type && Type::closure != type)
+		return Errc::type;
+	if (strong)
+		return invoke(*this, args);
+	lockGuard(lg);
+	if (*this)
+		return invoke(*this, args);
+	return Errc::type;
+}
+
+Var Var::operator()(Var && args)const
+{
+	if (Type::lazy == type)
+		return force()(std::move(args));
+	if (Type::native == type)
+		return invoke(*this, std::move(args));
+	if (Type::function != type && Type::closure != type)
+		throw TypeError(type, __FUNCTION__);
+	if (strong)
+		return invoke(*this, std::move(args));
+	lockGuard(lg);
+	if (*this)
+		return invoke(*this, std::move(args));
+	throw TypeError(type, __FUNCTION__);
+}
+
+Var::Ref Var::operator[](Key k)const
+{
+	if (Type::lazy == type)
+		return force()[std::move(k)];
+	if (Type::table == type && *this)
+		return Ref(std::move(k), this);
 	throw TypeError(type, __FUNCTION__);
 }
 
-Var Var::operator()(Var const & args)const
+Var const * Var::find(Key const & k)const
 {
-	if (Type::function != type)
+	if (Type::lazy == type)
+		return force().find(k);
+	if (Type::table != type)
 		throw TypeError(type, __FUNCTION__);
+
+	auto staff = [t=this->t, &k]() -> Var const* {
+		auto it = t->find(k);
+		return t->end() != it ? &it->second : nullptr;
+	};
 	if (strong)
-		return (*f)(args);
+		return staff();
 	lockGuard(lg);
 	if (*this)
-		return (*f)(args);
+		return staff();
 	throw TypeError(type, __FUNCTION__);
 }
 
-Var Var::operator()(Var && args)const
+bool Var::contains(Key const & k)const
+{
+	return find(k) != nullptr;
+}
+
+auto Var::tryGet(Key const & k)const -> Result<>
+{
+	if (Type::lazy == type)
+		return force().tryGet(k);
+	if (Type::table != type)
+		return Errc::type;
+
+	auto staff = [t=this->t, &k]() -> Result<> {
+		auto it = t->find(k);
+		return t->end() != it ? it->second : nil;
+	};
+	if (strong)
+		return staff();
+	lockGuard(lg);
+	if (*this)
+		return staff();
+	return Errc::type;
+}
+
+bool Var::erase(Key const & k)const
 {
-	if (Type::function != type)
+	if (Type::lazy == type)
+		return force().erase(k);
+	if (Type::table != type)
 		throw TypeError(type, __FUNCTION__);
+
+	auto staff = [t=this->t, &k] {
+		auto it = t->find(k);
+		if (t->end() == it)
+			return false;
+		if (t->changes)
+			record(*t, it->first);
+		if (!it->first.strong && weakable(it->first.type) && t->nWeakKey)
+			--t->nWeakKey;
+		t->erase(it);
+		::touch(*t);
+		return true;
+	};
 	if (strong)
-		return (*f)(std::move(args));
+		return staff();
 	lockGuard(lg);
 	if (*this)
-		return (*f)(std::move(args));
+		return staff();
 	throw TypeError(type, __FUNCTION__);
 }
 
-Var::Ref Var::operator[](Var k)const
+void Var::touch()const
 {
-	if (Type::table == type && *this)
-		return Ref(std::move(k), this);
+	if (Type::lazy == type)
+		return force().touch();
+	if (Type::array == type)
+		return;		//数组不缓存哈希，含数组的表也不缓存
+	if (Type::table != type)
+		throw TypeError(type, __FUNCTION__);
+	if (strong)
+		return ::touch(*t);
+	lockGuard(lg);
+	if (*this)
+		return ::touch(*t);
 	throw TypeError(type, __FUNCTION__);
 }
 
-auto Var::begin()const -> table_t::iterator
+auto Var::begin()const -> map_t::iterator
 {
+	if (Type::lazy == type)
+		return force().begin();
 	if (Type::table != type)
 		throw TypeError(type, __FUNCTION__);
-	if (strong)
+	if (strong) {
+		::touch(*t);
 		return t->begin();
+	}
 	lockGuard(lg);
-	if (*this)
+	if (*this) {
+		::touch(*t);
 		return t->begin();
+	}
 	throw TypeError(type, __FUNCTION__);
 }
 
-auto Var::end()const -> table_t::iterator
+auto Var::end()const -> map_t::iterator
 {
+	if (Type::lazy == type)
+		return force().end();
 	if (Type::table != type)
 		throw TypeError(type, __FUNCTION__);
-	if (strong)
+	if (strong) {
+		::touch(*t);
 		return t->end();
+	}
 	lockGuard(lg);
-	if (*this)
+	if (*this) {
+		::touch(*t);
 		return t->end();
+	}
 	throw TypeError(type, __FUNCTION__);
 }
 
-auto Var::cbegin()const -> table_t::const_iterator
+auto Var::cbegin()const -> map_t::const_iterator
 {
+	if (Type::lazy == type)
+		return force().cbegin();
 	if (Type::table != type)
 		throw TypeError(type, __FUNCTION__);
 	if (strong)
@@ -284,8 +1561,10 @@ auto Var::cbegin()const -> table_t::const_iterator
 	throw TypeError(type, __FUNCTION__);
 }
 
-auto Var::cend()const -> table_t::const_iterator
+auto Var::cend()const -> map_t::const_iterator
 {
+	if (Type::lazy == type)
+		return force().cend();
 	if (Type::table != type)
 		throw TypeError(type, __FUNCTION__);
 	if (strong)
@@ -298,15 +1577,15 @@ auto Var::cend()const -> table_t::const_iterator
 
 bool Var::setWeak(bool weak)const
 {
-	if (type < Type::function || strong != weak)
+	if (!weakable(type) || strong != weak)
 		return !strong;
 
 	lockGuard(lg);
 	if (weak) {
 		if (--mrc[t] < 1) {
-			type = Type::nil;
 			mrc.erase(t);
-			Type::function == type ? delete f : delete t;
+			deletePayload(*this);
+			type = Type::nil;
 		}
 		return strong = false;
 	}
@@ -322,18 +1601,132 @@ bool Var::setKeyWeak(Var k, bool weak)const
 	if (Type::table != type)
 		throw TypeError(type, __FUNCTION__);
 
+	//键将要或已经死亡时直接删除该项，避免改变表中键的类型与散列值
 	auto staff = [t=this->t, &k, weak] {
 		auto it = t->find(k);
-		return t->end() == it || it->first.setWeak(weak);
+		if (t->end() == it)
+			return true;
+		auto & key = it->first;
+		if (weakable(key.type) && key.strong == weak) {
+			if (weak ? 1 == mrc.find(key.t)->second : !mrc.count(key.t)) {
+				auto rtn = !key.strong;
+				t->erase(it);
+				::touch(*t);
+				return rtn;
+			}
+			weak ? ++t->nWeakKey : t->nWeakKey && --t->nWeakKey;
+		}
+		return key.setWeak(weak);
 	};
-	if (strong)
-		return staff();
 	lockGuard(lg);
 	if (*this)
 		return staff();
 	throw TypeError(type, __FUNCTION__);
 }
 
+size_t Var::sweep(chrono::nanoseconds budget)const
+{
+	if (Type::table != type)
+		throw TypeError(type, __FUNCTION__);
+	lockGuard(lg);
+	if (!*this)
+		throw TypeError(type, __FUNCTION__);
+
+	auto deadline = chrono::steady_clock::now() + budget;
+	size_t nErased = 0;
+	for (size_t n = 0; n < t->bucket_count() && t->nWeakKey; n += k_sweepBatch) {
+		nErased += sweepBuckets(*t, k_sweepBatch);
+		if (budget.count() && chrono::steady_clock::now() >= deadline)
+			break;
+	}
+	return nErased;
+}
+
+uint64_t Var::track(bool on)const
+{
+	if (Type::table != type)
+		throw TypeError(type, __FUNCTION__);
+	lockGuard(lg);
+	if (!*this)
+		throw TypeError(type, __FUNCTION__);
+
+	if (!on) {
+		t->changes.reset();
+	} else if (!t->changes) {
+		t->changes.reset(new table_t::changes_t);
+		for (auto & pair : *t)
+			trackNested(*t, pair.first, pair.second);
+	}
+	return g_version;
+}
+
+Var Var::diff(uint64_t since)const
+{
+	if (Type::table != type)
+		throw TypeError(type, __FUNCTION__);
+	lockGuard(lg);
+	if (!*this)
+		throw TypeError(type, __FUNCTION__);
+
+	auto patch = table();
+	patch["version"] = integer_t(g_version);
+	unordered_set<void const*> seen;
+	diffInto(*t, since, patch, seen);
+	return patch;
+}
+
+void Var::apply(Var const & patch)const
+{
+	if (Type::table != type)
+		throw TypeError(type, __FUNCTION__);
+	unordered_map<void const*, Var> copies;
+	applyPatch(*this, patch, copies);
+}
+
+
+Var::Key::Key(char const * p) noexcept
+{
+	if (p)
+		borrow(p, strlen(p));
+}
+
+Var::Key::Key(char const * p, size_t n) noexcept
+{
+	borrow(p, n);
+}
+
+Var::Key::Key(Ref & ref)
+	: _var(static_cast<Var const &>(std::move(ref)))
+{
+}
+
+Var::Key::Key(Ref && ref)
+	: _var(static_cast<Var const &>(std::move(ref)))
+{
+}
+
+Var::Key::Key(Key && rhs) noexcept
+	: _var(std::move(rhs._var))
+{
+	if (&rhs._buf == _var.y)
+		borrow(rhs._buf.data, rhs._buf.size);
+}
+
+void Var::Key::borrow(char const * p, size_t n) noexcept
+{
+	_buf.data = p;
+	_buf.size = n;
+	_var.y = &_buf;
+	_var.type = Type::strview;
+}
+
+Var Var::Key::take() &&
+{
+	if (&_buf == _var.y)
+		return string(_buf.data, _buf.size);
+	return std::move(_var);
+}
+
 
 Var * Var::Ref::get()
 {
@@ -366,52 +1759,77 @@ Var & Var::Ref::operator=(Ref && rhs)
 Var & Var::Ref::operator=(Var const & v)
 {
 	if (nil == _key)
-		return _key;
+		return _key._var;
 
 	auto & t = *_tbl->t;
 	if (_tbl->strong)
-		return t[std::move(_key)] = v;
+		return slot(t, std::move(_key).take()) = v;
 	lockGuard(lg);
 	if (*_tbl)
-		return t[std::move(_key)] = v;
+		return slot(t, std::move(_key).take()) = v;
 	throw TypeError(_tbl->type, __FUNCTION__);
 }
 
 Var & Var::Ref::operator=(Var && v)
 {
 	if (nil == _key)
-		return _key;
+		return _key._var;
 
 	auto & t = *_tbl->t;
 	if (_tbl->strong)
-		return t[std::move(_key)] = std::move(v);
+		return slot(t, std::move(_key).take()) = std::move(v);
+	lockGuard(lg);
+	if (*_tbl)
+		return slot(t, std::move(_key).take()) = std::move(v);
+	throw TypeError(_tbl->type, __FUNCTION__);
+}
+
+//只读：键不存在时返回 nil，不插入也不记录
+Var::Ref::operator Var const &() &&
+{
+	if (nil == _key)
+		return nil;
+
+	auto staff = [this]() -> Var const& {
+		auto p = this->get();
+		return p ? *p : nil;
+	};
+	if (_tbl->strong)
+		return staff();
 	lockGuard(lg);
 	if (*_tbl)
-		return t[std::move(_key)] = std::move(v);
+		return staff();
 	throw TypeError(_tbl->type, __FUNCTION__);
 }
 
-Var::Ref::operator Var &()
+//可写的引用：视为写入，键不存在时插入 nil，并记录修改
+Var::Ref::operator Var &() &
 {
 	if (nil == _key)
-		return _key;
+		return _key._var;
 
 	auto & t = *_tbl->t;
 	if (_tbl->strong)
-		return t[std::move(_key)];
+		return slot(t, std::move(_key).take());
 	lockGuard(lg);
 	if (*_tbl)
-		return t[std::move(_key)];
+		return slot(t, std::move(_key).take());
 	throw TypeError(_tbl->type, __FUNCTION__);
 }
 
+//使 Var & v = t[k] 可用：与具名的 Ref 相同；const 只为让读取优先选 &&
+Var::Ref::operator Var &() const &&
+{
+	return const_cast<Ref &>(*this);
+}
+
 void Var::Ref::swap(Ref && rhs)
 {
 	auto staff = [this, &rhs] {
 		if (auto p = this->get())
-			p->swap(rhs);
+			rhs.swap(*p);
 		else if (auto p = rhs.get())
-			p->swap(*this);
+			this->swap(*p);
 	};
 	if (_tbl->strong && rhs._tbl->strong)
 		return staff();
@@ -421,11 +1839,15 @@ void Var::Ref::swap(Ref && rhs)
 
 void Var::Ref::swap(Var & rhs)
 {
+	if (nil == _key)
+		return rhs.swap(_key._var);
+
+	auto & t = *_tbl->t;
 	if (_tbl->strong)
-		return rhs.swap(*this);
+		return rhs.swap(slot(t, std::move(_key).take()));
 	lockGuard(lg);
 	if (*_tbl)
-		return rhs.swap(*this);
+		return rhs.swap(slot(t, std::move(_key).take()));
 	throw TypeError(_tbl->type, __FUNCTION__);
 }
 
@@ -477,29 +1899,18 @@ Var Var::Ref::operator()(Var && args)
 	return staff();
 }
 
-Var::Ref Var::Ref::operator[](Var const & k)
-{
-	if (_tbl->strong) {
-		auto p = get();
-		return Ref(p ? (*p)[k] : nil[k]);
-	}
-	lockGuard(lg);
-	auto p = get();
-	return Ref(p ? (*p)[k] : nil[k]);
-}
-
-Var::Ref Var::Ref::operator[](Var && k)
+Var::Ref Var::Ref::operator[](Key k)
 {
 	if (_tbl->strong) {
 		auto p = get();
-		return Ref(p ? (*p)[std::move(k)] : nil[std::move(k)]);
+		return p ? (*p)[std::move(k)] : nil[std::move(k)];
 	}
 	lockGuard(lg);
 	auto p = get();
-	return Ref(p ? (*p)[std::move(k)] : nil[std::move(k)]);
+	return p ? (*p)[std::move(k)] : nil[std::move(k)];
 }
 
-auto Var::Ref::begin() -> table_t::iterator
+auto Var::Ref::begin() -> map_t::iterator
 {
 	auto staff = [this] {
 		auto p = this->get();
@@ -511,7 +1922,7 @@ auto Var::Ref::begin() -> table_t::iterator
 	return staff();
 }
 
-auto Var::Ref::end() -> table_t::iterator
+auto Var::Ref::end() -> map_t::iterator
 {
 	auto staff = [this] {
 		auto p = this->get();
@@ -523,7 +1934,7 @@ auto Var::Ref::end() -> table_t::iterator
 	return staff();
 }
 
-auto Var::Ref::cbegin() -> table_t::const_iterator
+auto Var::Ref::cbegin() -> map_t::const_iterator
 {
 	auto staff = [this] {
 		auto p = this->get();
@@ -535,7 +1946,7 @@ auto Var::Ref::cbegin() -> table_t::const_iterator
 	return staff();
 }
 
-auto Var::Ref::cend() -> table_t::const_iterator
+auto Var::Ref::cend() -> map_t::const_iterator
 {
 	auto staff = [this] {
 		auto p = this->get();
@@ -586,22 +1997,10 @@ bool Var::Ref::setKeyWeak(Var && k, bool w)
 
 bool operator==(Var const & lhs, Var const & rhs)
 {
+	if (Var::Type::lazy == lhs.type || Var::Type::lazy == rhs.type)
+		return operator==(lhs.force(), rhs.force());
 	!lhs, !rhs;
-	if (lhs.type != rhs.type)
-		return false;
-
-	switch (rhs.type) {
-		case Var::Type::nil:
-			return true;
-		case Var::Type::boolean:
-			return lhs.b == rhs.b;
-		case Var::Type::number:
-			return lhs.n == rhs.n;
-		case Var::Type::string:
-			return lhs.s == rhs.s || *lhs.s == *rhs.s;
-		default:
-			return lhs.t == rhs.t;
-	}
+	return equal_to<Var>{}(lhs, rhs);
 }
 
 ostream & operator<<(ostream & os, Var const & rhs)
@@ -611,6 +2010,7 @@ ostream & operator<<(ostream & os, Var const & rhs)
 		default:
 			return os << toCString(s);
 		case Var::Type::string:
+		case Var::Type::strview:
 			return os << '\"' << toCString(s) << '\"';
 		case Var::Type::table:
 			return os << '{' << toCString(s) << '}';
@@ -619,99 +2019,137 @@ ostream & operator<<(ostream & os, Var const & rhs)
 
 bool operator<(Var const & lhs, Var const & rhs)
 {
-	if (lhs.type != rhs.type)
-		throw Var::TypeError(lhs.type, rhs.type, __FUNCTION__);
-
-	switch (rhs.type) {
-		case Var::Type::number:
-			return lhs.n < rhs.n;
-		case Var::Type::string:
-			return lhs.s != rhs.s && *lhs.s < *rhs.s;
-		default:
-			throw Var::TypeError(lhs.type, rhs.type, __FUNCTION__);
-	}
+	auto r = tryLess(lhs, rhs);
+	if (r)
+		return r.value;
+	throw Var::TypeError(lhs.type, rhs.type, __FUNCTION__);
 }
 
 bool operator>(Var const & lhs, Var const & rhs)
 {
-	if (lhs.type != rhs.type)
-		throw Var::TypeError(lhs.type, rhs.type, __FUNCTION__);
-
-	switch (rhs.type) {
-		case Var::Type::number:
-			return lhs.n > rhs.n;
-		case Var::Type::string:
-			return lhs.s != rhs.s && *lhs.s > *rhs.s;
-		default:
-			throw Var::TypeError(lhs.type, rhs.type, __FUNCTION__);
-	}
+	auto r = tryGreater(lhs, rhs);
+	if (r)
+		return r.value;
+	throw Var::TypeError(lhs.type, rhs.type, __FUNCTION__);
 }
 
 Var operator+(Var const & lhs, Var const & rhs)
 {
-	if (lhs.type != rhs.type)
-		throw Var::TypeError(lhs.type, rhs.type, __FUNCTION__);
-
-	switch (rhs.type) {
-		case Var::Type::number:
-			return lhs.n + rhs.n;
-		case Var::Type::string:
-			return *lhs.s + *rhs.s;
-		default:
-			throw Var::TypeError(lhs.type, rhs.type, __FUNCTION__);
-	}
+	return check(tryAdd(lhs, rhs), lhs, rhs, __FUNCTION__);
 }
 
 Var operator-(Var const & lhs, Var const & rhs)
 {
-	if (Var::Type::number != lhs.type || Var::Type::number != rhs.type)
-		throw Var::TypeError(lhs.type, rhs.type, __FUNCTION__);
-	return lhs.n - rhs.n;
+	return check(trySub(lhs, rhs), lhs, rhs, __FUNCTION__);
 }
 
 Var operator*(Var const & lhs, Var const & rhs)
 {
-	if (Var::Type::number != lhs.type || Var::Type::number != rhs.type)
-		throw Var::TypeError(lhs.type, rhs.type, __FUNCTION__);
-	return lhs.n * rhs.n;
+	return check(tryMul(lhs, rhs), lhs, rhs, __FUNCTION__);
 }
 
 Var operator/(Var const & lhs, Var const & rhs)
 {
-	if (Var::Type::number != lhs.type || Var::Type::number != rhs.type)
-		throw Var::TypeError(lhs.type, rhs.type, __FUNCTION__);
-	return lhs.n / rhs.n;
+	return check(tryDiv(lhs, rhs), lhs, rhs, __FUNCTION__);
 }
 
 Var operator%(Var const & lhs, Var const & rhs)
 {
-	if (Var::Type::number != lhs.type || Var::Type::number != rhs.type)
-		throw Var::TypeError(lhs.type, rhs.type, __FUNCTION__);
-	return fmod(lhs.n, rhs.n);
+	return check(tryMod(lhs, rhs), lhs, rhs, __FUNCTION__);
 }
 
 Var operator^(Var const & lhs, Var const & rhs)
 {
-	if (Var::Type::number != lhs.type || Var::Type::number != rhs.type)
-		throw Var::TypeError(lhs.type, rhs.type, __FUNCTION__);
-	return pow(lhs.n, rhs.n);
+	return check(tryPow(lhs, rhs), lhs, rhs, __FUNCTION__);
+}
+
+Var::Result<bool> tryLess(Var const & lhs, Var const & rhs)
+{
+	if (Var::Type::lazy == lhs.type || Var::Type::lazy == rhs.type)
+		return tryLess(lhs.force(), rhs.force());
+	char const *p, *q;
+	size_t n, m;
+	if (textOf(lhs, p, n) && textOf(rhs, q, m))
+		return textCompare(p, n, q, m) < 0;
+	if (isNumber(lhs) && isNumber(rhs))
+		return -1 == order(lhs, rhs);
+	return Var::Errc::type;
+}
+
+Var::Result<bool> tryGreater(Var const & lhs, Var const & rhs)
+{
+	if (Var::Type::lazy == lhs.type || Var::Type::lazy == rhs.type)
+		return tryGreater(lhs.force(), rhs.force());
+	char const *p, *q;
+	size_t n, m;
+	if (textOf(lhs, p, n) && textOf(rhs, q, m))
+		return textCompare(p, n, q, m) > 0;
+	if (isNumber(lhs) && isNumber(rhs))
+		return 1 == order(lhs, rhs);
+	return Var::Errc::type;
+}
+
+Var::Result<> tryAdd(Var const & lhs, Var const & rhs)
+{
+	if (Var::Type::lazy == lhs.type || Var::Type::lazy == rhs.type)
+		return tryAdd(lhs.force(), rhs.force());
+	char const *p, *q;
+	size_t n, m;
+	if (textOf(lhs, p, n) && textOf(rhs, q, m)) {
+		string rtn;
+		rtn.reserve(n + m);
+		return Var(std::move(rtn.append(p, n).append(q, m)));
+	}
+	return arith(ArrayOp::add, lhs, rhs);
+}
+
+Var::Result<> trySub(Var const & lhs, Var const & rhs)
+{
+	return arith(ArrayOp::sub, lhs, rhs);
+}
+
+Var::Result<> tryMul(Var const & lhs, Var const & rhs)
+{
+	return arith(ArrayOp::mul, lhs, rhs);
+}
+
+Var::Result<> tryDiv(Var const & lhs, Var const & rhs)
+{
+	return arith(ArrayOp::div, lhs, rhs);
+}
+
+Var::Result<> tryMod(Var const & lhs, Var const & rhs)
+{
+	return arith(ArrayOp::mod, lhs, rhs);
+}
+
+Var::Result<> tryPow(Var const & lhs, Var const & rhs)
+{
+	return arith(ArrayOp::pow, lhs, rhs);
 }
 
 Var toNumber(Var const & var)
 {
+	if (Var::Type::lazy == var.type)
+		return toNumber(var.force());
 	!var;
 	switch (var.type) {
 		default:
 			return nullptr;
 		case Var::Type::number:
+		case Var::Type::integer:
 			return var;
 		case Var::Type::string:
-			return atof(var.s->c_str());
+			return parseNumber(var.s->c_str());
+		case Var::Type::strview:
+			return parseNumber(var.y->data, var.y->size);
 	}
 }
 
 Var toString(Var const & var)
 {
+	if (Var::Type::lazy == var.type)
+		return toString(var.force());
 	!var;
 	char s[24] = "";
 	switch (var.type) {
@@ -722,8 +2160,14 @@ Var toString(Var const & var)
 		case Var::Type::number:
 			sprintf(s, "%g", var.n);
 			return s;
+		case Var::Type::integer:
+			sprintf(s, "%lld", (long long)var.i);
+			return s;
 		case Var::Type::string:
 			return var;
+		case Var::Type::bytes:
+		case Var::Type::strview:
+			return string(var.y->data, var.y->size);
 		default:
 			sprintf(s, "0x%p", var.t);
 			return s;
@@ -732,22 +2176,153 @@ Var toString(Var const & var)
 
 char const * toCString(Var const & var)
 {
+	if (Var::Type::lazy == var.type)
+		return toCString(var.force());
 	if (Var::Type::string != var.type)
 		throw Var::TypeError(var.type, __FUNCTION__);
 	return var.s->c_str();
 }
 
+Var sum(Var const & var)
+{
+	if (Var::Type::lazy == var.type)
+		return sum(var.force());
+	!var;
+	if (Var::Type::array != var.type)
+		throw Var::TypeError(var.type, __FUNCTION__);
+	return arrayReduce(ArrayReduce::sum, var.a->data(), var.a->size());
+}
+
+Var min(Var const & var)
+{
+	if (Var::Type::lazy == var.type)
+		return min(var.force());
+	!var;
+	if (Var::Type::array != var.type)
+		throw Var::TypeError(var.type, __FUNCTION__);
+	if (var.a->empty())
+		return nullptr;
+	return arrayReduce(ArrayReduce::min, var.a->data(), var.a->size());
+}
+
+Var max(Var const & var)
+{
+	if (Var::Type::lazy == var.type)
+		return max(var.force());
+	!var;
+	if (Var::Type::array != var.type)
+		throw Var::TypeError(var.type, __FUNCTION__);
+	if (var.a->empty())
+		return nullptr;
+	return arrayReduce(ArrayReduce::max, var.a->data(), var.a->size());
+}
+
+Var dot(Var const & lhs, Var const & rhs)
+{
+	if (Var::Type::lazy == lhs.type || Var::Type::lazy == rhs.type)
+		return dot(lhs.force(), rhs.force());
+	!lhs, !rhs;
+	if (Var::Type::array != lhs.type || Var::Type::array != rhs.type)
+		throw Var::TypeError(lhs.type, rhs.type, __FUNCTION__);
+	if (lhs.a->size() != rhs.a->size())
+		throw length_error(string("Call ")+__FUNCTION__+" with arrays of different sizes");
+	return arrayDot(lhs.a->data(), rhs.a->data(), lhs.a->size());
+}
+
+Var slice(Var const & var, size_t pos, size_t n)
+{
+	if (Var::Type::lazy == var.type)
+		return slice(var.force(), pos, n);
+	!var;
+	auto y = new Var::bytes_t;
+	switch (var.type) {
+		case Var::Type::string:
+			y->data = var.s->data();
+			y->size = var.s->size();
+			y->owner = var;
+			break;
+		case Var::Type::bytes:
+		case Var::Type::strview:
+			y->data = var.y->data;
+			y->size = var.y->size;
+			y->owner = var.y->owner ? var.y->owner : var;
+			break;
+		default:
+			delete y;
+			throw Var::TypeError(var.type, __FUNCTION__);
+	}
+	if (pos > y->size) {
+		delete y;
+		throw out_of_range(string("Call ")+__FUNCTION__+" with a position out of range");
+	}
+	y->data += pos;
+	y->size = min(n, y->size - pos);
+	return adopt(y, Var::Type::bytes == var.type ? Var::Type::bytes : Var::Type::strview);
+}
+
 ostream & printTable(Var const & var, ostream & os)
 {
 	if (Var::Type::table != var.type)
 		throw Var::TypeError(var.type, __FUNCTION__);
 	os << "{\n";
-	for (auto & pair : var)
-		os << "\t[" << pair.first << "] = " << pair.second << '\n';
+	for (auto it = var.cbegin(); it != var.cend(); ++it)
+		os << "\t[" << it->first << "] = " << it->second << '\n';
 	os << "}\n";
 	return os;
 }
 
+Var deepClone(Var const & var)
+{
+	Var hold = var;
+	unordered_map<void const*, Var> copies;
+	return cloneOf(hold, copies);
+}
+
+size_t deepHash(Var const & var)
+{
+	Var hold = var;
+	vector<Var::table_t const*> path;
+	size_t low = SIZE_MAX;
+	return structHash(hold, path, low);
+}
+
+bool deepEqual(Var const & lhs, Var const & rhs)
+{
+	Var a = lhs, b = rhs;
+	//大表先并行计算哈希，不同则不必逐项比较
+	if (Var::Type::table == a.type && Var::Type::table == b.type && a.t != b.t
+		&& a.t->size() == b.t->size() && a.t->size() >= k_parallelMin)
+		deepHash(a), deepHash(b);
+	vector<pair<void const*, void const*>> assumed;
+	return structEqual(a, b, assumed);
+}
+
+Var canonicalize(Var const & var)
+{
+	Var hold = var;
+	unordered_map<void const*, Var> copies;
+	auto & pool = canonical();
+	lock_guard<mutex> lg(pool.m);
+	return canonOf(hold, pool, copies);
+}
+
+size_t canonicalSize()
+{
+	auto & pool = canonical();
+	lock_guard<mutex> lg(pool.m);
+	return pool.strings.size();
+}
+
+void clearCanonical()
+{
+	Canonical old;
+	auto & pool = canonical();
+	{
+		lock_guard<mutex> lg(pool.m);
+		old.strings.swap(pool.strings);
+	}
+}
+
 
 Var::TypeError::TypeError(Type type, string const & func)
 	: runtime_error("Call "+func+" with a "+TypeName(type))
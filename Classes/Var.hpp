@@ -2,12 +2,32 @@
 #define VAR_HPP
 
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <unordered_map>
-struct Var;
+#include <unordered_set>
+#include <vector>
+
+
+//线程模型作为模板参数。SharedPolicy 即 Var：引用计数在全局的 Var::mrc 中，由 Var::mrcm 保护，可在线程间传递。
+//ThreadConfinedPolicy 即 LocalVar：限于一个线程的句柄，句柄的复制与析构不加锁；所持的值仍是 Var，见文件末
+struct SharedPolicy {};
+struct ThreadConfinedPolicy {};
+template<typename Policy>
+class BasicVar;
+using Var = BasicVar<SharedPolicy>;
+using LocalVar = BasicVar<ThreadConfinedPolicy>;
 
 
 namespace std
@@ -19,67 +39,130 @@ namespace std
 		using result_type = size_t;
 		size_t operator()(Var const &)const noexcept;
 	};
+
+	//表键的相等：不检查弱引用是否失效，死亡的弱键只与自身相等
+	template<>
+	struct equal_to<Var>
+	{
+		using first_argument_type = Var;
+		using second_argument_type = Var;
+		using result_type = bool;
+		bool operator()(Var const &, Var const &)const noexcept;
+	};
 }
 
 
-struct Var
+template<>
+class BasicVar<SharedPolicy>
 {
+public:
 	//类型
 	enum class Type : char {
-		nil, boolean, number, string, function, table
+		nil, boolean, number, string, function, table, array, bytes,
+		strview,	//与 string 透明互通，数据为 bytes_t
+		native,		//函数指针，就地存储
+		closure,	//小型可平凡复制的可调用对象，存于 closure_t
+		integer,	//64 位整数，与整数值的 number 透明互通（相等、散列、比较）
+		lazy		//惰性值，存于 lazy_t，被触及时求值，结果留在 lazy_t 中
 	};
 	static std::string TypeName(Type) noexcept;
 
 	using nil_t		= decltype(nullptr);
 	using bool_t	= bool;
 	using number_t	= double;
+	using integer_t	= std::int64_t;
 	using string_t	= const std::string;
 	using function_t= const std::function<Var(Var)>;
-	using table_t	= std::unordered_map<Var, Var>;
+	using native_t	= Var (*)(Var);
+	struct	closure_t;
+	using map_t		= std::unordered_map<Var, Var>;
+	struct	table_t;
+	using array_t	= std::vector<number_t>;
+	struct	bytes_t;
+	struct	lazy_t;
+	class	Key;
 	class	Ref;
 	struct	TypeError;
 
+	//错误码：try* 接口失败时返回，不构造异常与消息
+	enum class Errc : char {
+		none, type, size
+	};
+	template<typename Ty = Var>
+	struct	Result;
+
 	//管理员：引用计数
 	static std::unordered_map<void const*, int> mrc;
 	static std::recursive_mutex mrcm;
 	static const Var nil;
+	//元素数不少于 minSize 的表在最后一个引用释放时交给后台线程析构，0 为关闭（缺省）
+	static void deferRelease(std::size_t minSize) noexcept;
+	//等待析构的表数
+	static std::size_t pendingRelease() noexcept;
+	//阻塞至已交出的表全部析构完毕
+	static void flushRelease();
 
 	//成员
 	union {
 		bool_t		b;
 		number_t	n;
+		integer_t	i;
 		string_t	*s;
 		function_t	*f;
+		native_t	p;
+		closure_t	*c;
+		array_t		*a;
+		bytes_t		*y;
+		lazy_t		*l;
 		table_t		*t	= 0;
 	};
 	mutable Type type	= Type::nil;
 	mutable bool strong	= false;
 
 	//构造
-	constexpr Var() noexcept					{}
-	constexpr Var(nil_t) noexcept				{}
-	constexpr Var(bool_t val) noexcept			: b(val), type(Type::boolean) {}
-	constexpr Var(number_t val) noexcept		: n(val), type(Type::number) {}
-	constexpr Var(int val) noexcept				: n(val), type(Type::number) {}
-	constexpr Var(unsigned val) noexcept		: n(val), type(Type::number) {}
-	Var(char const *);
-	Var(std::string&&);
-	Var(std::string const &);
+	constexpr BasicVar() noexcept				{}
+	constexpr BasicVar(nil_t) noexcept			{}
+	constexpr BasicVar(bool_t val) noexcept		: b(val), type(Type::boolean) {}
+	constexpr BasicVar(number_t val) noexcept	: n(val), type(Type::number) {}
+	constexpr BasicVar(int val) noexcept		: i(val), type(Type::integer) {}
+	constexpr BasicVar(unsigned val) noexcept	: i(val), type(Type::integer) {}
+	constexpr BasicVar(long val) noexcept		: i(val), type(Type::integer) {}
+	constexpr BasicVar(long long val) noexcept	: i(val), type(Type::integer) {}
+	BasicVar(unsigned long val) noexcept		: BasicVar((unsigned long long)val) {}
+	BasicVar(unsigned long long) noexcept;
+	BasicVar(char const *);
+	BasicVar(std::string&&);
+	BasicVar(std::string const &);
 	static Var function(function_t &);
+	static Var function(native_t) noexcept;
+	template<typename Fn>
+	static Var function(Fn);
 	static Var table();
-	Var(std::initializer_list<Var>);
+	static Var array(std::size_t n = 0, number_t val = 0);
+	static Var array(std::initializer_list<number_t>);
+	static Var array(array_t&&);
+	static Var bytes(void const *, std::size_t);
+	static Var bytes(void const *, std::size_t, std::function<void()> release);
+	static Var bytes(std::string&&);
+	static Var view(char const *, std::size_t, std::function<void()> release);
+	static Var lazy(std::function<Var()>);
+	BasicVar(std::initializer_list<Var>);
 
 	//Special Member Function
-	~Var() noexcept;
-	Var(Var const &);
+	~BasicVar() noexcept;
+	BasicVar(Var const &);
 	Var & operator=(Var const &);
-	Var(Var&&) noexcept;
+	BasicVar(Var&&) noexcept;
 	Var & operator=(Var && rhs) noexcept		{ swap(rhs); return *this; }
 
 	//全类型
 	void swap(Var &) noexcept;
-	explicit operator bool()const noexcept;
-	bool operator!()const noexcept				{ return !(bool)*this; }
+	explicit operator bool()const;
+	bool operator!()const						{ return !(bool)*this; }
+
+	//惰性：返回求值的结果，其余类型返回自身。Var 本身不变，可在线程间共享；
+	//operator bool、运算、调用、toString 与表访问都经此转发
+	Var const & force()const;
 
 	//数字
 	Var operator-()const;
@@ -87,26 +170,115 @@ struct Var
 	//函数
 	Var operator()(Var const &)const;
 	Var operator()(Var&&)const;
+	Result<> tryCall(Var const &)const;
 
 	//表
-	Ref operator[](Var)const;
-	table_t::iterator begin()const;
-	table_t::iterator end()const;
-	table_t::const_iterator cbegin()const;
-	table_t::const_iterator cend()const;
+	Ref operator[](Key)const;
+	Var const * find(Key const &)const;
+	bool contains(Key const &)const;
+	Result<> tryGet(Key const &)const;
+	bool erase(Key const &)const;
+	//begin、end 与取 Var & 视为将要修改，使缓存的结构哈希失效；只读的遍历用 cbegin、cend。
+	//持有可写的迭代器或 Var & 期间求过哈希、或经 t 直接修改表之后，须再调用 touch；对数组调用什么也不做
+	void touch()const;
+	map_t::iterator begin()const;
+	map_t::iterator end()const;
+	map_t::const_iterator cbegin()const;
+	map_t::const_iterator cend()const;
+
+	//修改记录：track 之后经 Ref 的赋值、交换、取 Var & 与 erase 按全局版本号记录；读不记录，经迭代器的修改不记录。
+	//diff 返回 {version, set = {k = v}, erase = {k = true}, nested = {k = 子表的补丁}}，
+	//只含 since 之后修改的键；apply 把补丁应用到本表，set 中的表与数组被深复制
+	std::uint64_t track(bool on = true)const;
+	Var diff(std::uint64_t since)const;
+	void apply(Var const & patch)const;
 
 	//强弱转换
 	bool setWeak(bool weak = true)const;
 	bool setKeyWeak(Var, bool weak = true)const;
+	std::size_t sweep(std::chrono::nanoseconds budget = {})const;
+};
+
+//不可变；切片与 owner 共享缓冲区，owner 为 nil 时数据存于 buffer 或外部内存
+struct Var::bytes_t
+{
+	char const *			data	= nullptr;
+	std::size_t				size	= 0;
+	Var						owner;
+	std::string				buffer;
+	std::function<void()>	release;
+
+	~bytes_t()											{ if (release) release(); }
+};
+
+//fn 只执行一次，并发求值时其余线程等待；fn 抛出异常时下次触及重试。value 求得后不再修改，
+//之后的触及只读 done，不加锁
+struct Var::lazy_t
+{
+	std::mutex				m;
+	std::function<Var()>	fn;
+	Var						value;
+	std::atomic<bool>		done{false};
+
+	Var const & get()
+	{
+		if (done.load(std::memory_order_acquire))
+			return value;
+		std::lock_guard<std::mutex> lg(m);
+		if (!done.load(std::memory_order_relaxed)) {
+			value = fn();
+			fn = nullptr;
+			done.store(true, std::memory_order_release);
+		}
+		return value;
+	}
+};
+
+inline Var const & Var::force()const					{ return Type::lazy == type ? l->get().force() : *this; }
+
+//查找用的键：字符串只借用调用方的内存，不分配、不计引用；插入表时才复制为 string。
+//借用的字符串须在使用 Key 的整个表达式内有效
+class Var::Key
+{
+	bytes_t _buf;
+	Var _var;
+
+	friend Var;
+	friend Ref;
+	void borrow(char const *, std::size_t) noexcept;
+	Var take() &&;
+
+public:
+	Key(nil_t = nullptr) noexcept					{}
+	Key(bool_t val) noexcept						: _var(val) {}
+	Key(int val) noexcept							: _var(val) {}
+	Key(unsigned val) noexcept						: _var(val) {}
+	Key(long val) noexcept							: _var(val) {}
+	Key(long long val) noexcept						: _var(val) {}
+	Key(unsigned long val) noexcept					: _var(val) {}
+	Key(unsigned long long val) noexcept			: _var(val) {}
+	Key(number_t val) noexcept						: _var(val) {}
+	Key(char const *) noexcept;
+	Key(char const *, std::size_t) noexcept;
+	Key(std::string const & val) noexcept			: Key(val.data(), val.size()) {}
+	Key(std::string && val)							: _var(std::move(val)) {}
+	Key(Var const & val)							: _var(val.force()) {}
+	Key(Var && val)									: _var(Type::lazy == val.type ? Var(val.force()) : std::move(val)) {}
+	Key(Ref &);
+	Key(Ref &&);
+	Key(Key &&) noexcept;
+	Key & operator=(Key const &)					= delete;
+
+	operator Var const &()const noexcept			{ return _var; }
 };
 
 class Var::Ref
 {
-	Var _key;
+	Key _key;
 	Var const * _tbl;
 
 	friend Var;
-	Ref(Var && k, Var const * t) noexcept			: _key(std::move(k)), _tbl(t) {}
+	Ref(Key && k, Var const * t) noexcept			: _key(std::move(k)), _tbl(t) {}
 	Ref(Ref&&) noexcept								= default;
 	Var * get();
 
@@ -117,7 +289,11 @@ public:
 	Var & operator=(Ref && rhs);
 	Var & operator=(Var const &);
 	Var & operator=(Var&&);
-	operator Var &();
+	//读取（Var x = t[k]、传给 Var const &）不插入，键不存在时为 Var::nil；
+	//取 Var &（Var & v = t[k] 或具名的 Ref）视为写入：键不存在时插入 nil，并记录修改
+	operator Var const &() &&;
+	operator Var &() &;
+	operator Var &() const &&;
 
 	void swap(Ref && rhs);
 	void swap(Var & rhs);
@@ -127,12 +303,11 @@ public:
 	Var operator-();
 	Var operator()(Var const &);
 	Var operator()(Var&&);
-	Ref operator[](Var const &);
-	Ref operator[](Var&&);
-	table_t::iterator begin();
-	table_t::iterator end();
-	table_t::const_iterator cbegin();
-	table_t::const_iterator cend();
+	Ref operator[](Key);
+	map_t::iterator begin();
+	map_t::iterator end();
+	map_t::const_iterator cbegin();
+	map_t::const_iterator cend();
 	bool setWeak(bool);
 	bool setKeyWeak(Var const &, bool);
 	bool setKeyWeak(Var&&, bool);
@@ -142,7 +317,7 @@ public:
 bool operator==(Var const &, Var const &);
 inline bool operator!=(Var const & lhs, Var const & rhs)	{ return !(lhs == rhs); }
 std::ostream & operator<<(std::ostream &, Var const &);
-inline std::string type(Var const & var)					{ !var; return Var::TypeName(var.type); }
+inline std::string type(Var const & var)					{ auto & v = var.force(); !v; return Var::TypeName(v.type); }
 
 //数字、字符串
 bool operator<(Var const &, Var const &);
@@ -151,7 +326,7 @@ inline bool operator>=(Var const & lhs, Var const & rhs)	{ return !(lhs < rhs);
 inline bool operator<=(Var const & lhs, Var const & rhs)	{ return !(lhs > rhs); }
 Var operator+(Var const &, Var const &);
 
-//数字
+//数字、数组
 Var operator-(Var const &, Var const &);
 Var operator*(Var const &, Var const &);
 Var operator/(Var const &, Var const &);
@@ -165,12 +340,75 @@ Ty toNumber(Var const &);
 Var toString(Var const &);
 char const * toCString(Var const &);
 
+//数组
+Var sum(Var const &);
+Var min(Var const &);
+Var max(Var const &);
+Var dot(Var const &, Var const &);
+
+//字符串、字节
+Var slice(Var const &, std::size_t pos, std::size_t n = std::string::npos);
+
 //表
 std::ostream & printTable(Var const &, std::ostream & rtn = std::cout);
+//深复制表与数组，保持共享与环；弱引用不复制，仍指向原对象
+Var deepClone(Var const &);
+//按内容递归比较，表的键按表内相等；无环且不含弱引用值的表缓存哈希，至该表或其子表被修改，大表并行计算
+std::size_t deepHash(Var const &);
+bool deepEqual(Var const &, Var const &);
+//哈希合并：内容相同的字符串换成全局池中的同一份。表与数组复制一份返回，保持共享与环，原表不动；
+//可变的表不合并，需合并表时先冻结，见 Frozen.hpp。池持有强引用，clearCanonical 释放
+Var canonicalize(Var const &);
+std::size_t canonicalSize();
+void clearCanonical();
+
+//不抛异常
+Var::Result<bool> tryLess(Var const &, Var const &);
+Var::Result<bool> tryGreater(Var const &, Var const &);
+Var::Result<> tryAdd(Var const &, Var const &);
+Var::Result<> trySub(Var const &, Var const &);
+Var::Result<> tryMul(Var const &, Var const &);
+Var::Result<> tryDiv(Var const &, Var const &);
+Var::Result<> tryMod(Var const &, Var const &);
+Var::Result<> tryPow(Var const &, Var const &);
+template<typename Ty>
+Var::Result<Ty> tryNumber(Var const &);
 
 
 //-------------------------------Implementation---------------------------------
 
+//弱键的对象死亡后，其项在插入时按桶增量清除，或由 sweep 按时间预算清除
+struct Var::table_t : map_t
+{
+	using map_t::map_t;
+
+	std::size_t		nWeakKey	= 0;	//弱键个数的上界
+	std::size_t		sweepAt		= 0;	//下一个待清扫的桶
+
+	struct changes_t;
+	std::unique_ptr<changes_t> changes;	//track 开启时非空
+
+	struct hash_t;
+	std::atomic<std::uint64_t>		version{0};		//每次修改递增
+	std::atomic<bool>				hashed{false};	//hash 可能非空
+	std::shared_ptr<hash_t const>	hash;			//结构哈希的缓存，经 std::atomic_load/atomic_store 访问
+};
+
+//缓存时本表与各直接子表的版本；子表持强引用，本表被修改时释放
+struct Var::table_t::hash_t
+{
+	std::size_t									value;
+	std::uint64_t								version;
+	std::vector<std::pair<Var, std::uint64_t>>	children;
+};
+
+struct Var::table_t::changes_t
+{
+	std::unordered_map<Var, std::uint64_t>				latest;	//键 → 最后修改的版本
+	std::deque<std::pair<std::uint64_t, Var const*>>	log;	//版本递增，指向 latest 中的键
+	std::unordered_set<Var>								nested;	//值为表的键
+};
+
 struct Var::TypeError : std::runtime_error
 {
 	TypeError(Type, std::string const &);
@@ -179,13 +417,127 @@ struct Var::TypeError : std::runtime_error
 
 
 template<typename Ty>
-Ty toNumber(Var const & var)
+struct Var::Result
+{
+	Ty		value	= Ty();
+	Errc	error	= Errc::none;
+
+	Result(Ty val)									: value(std::move(val)) {}
+	Result(Errc err) noexcept						: error(err) {}
+	explicit operator bool()const noexcept			{ return Errc::none == error; }
+};
+
+
+//小型可平凡复制的可调用对象：就地存储，调用时不经过 std::function
+struct Var::closure_t
+{
+	static constexpr std::size_t capacity = 4 * sizeof(void*);
+
+	Var (*invoke)(void *, Var);
+	alignas(std::max_align_t) unsigned char data[capacity];
+
+	template<typename Fn>
+	using fits = std::integral_constant<bool, std::is_trivially_copyable<Fn>::value
+		&& sizeof(Fn) <= capacity && alignof(Fn) <= alignof(std::max_align_t)>;
+
+	template<typename Fn>
+	static Var make(Fn fn, std::true_type)			{ return Var::function(native_t(fn)); }
+	template<typename Fn>
+	static Var make(Fn fn, std::false_type)			{ return store(std::move(fn), fits<Fn>{}); }
+	template<typename Fn>
+	static Var store(Fn fn, std::false_type)		{ return Var::function(function_t(std::move(fn))); }
+	template<typename Fn>
+	static Var store(Fn fn, std::true_type)
+	{
+		auto c = new closure_t;
+		new(c->data) Fn(std::move(fn));
+		c->invoke = [](void * p, Var args) -> Var { return (*static_cast<Fn*>(p))(std::move(args)); };
+		return wrap(c);
+	}
+	static Var wrap(closure_t *);
+};
+
+
+template<typename Fn>
+Var Var::function(Fn fn)
+{
+	return closure_t::make(std::move(fn), std::is_convertible<Fn, native_t>{});
+}
+
+template<typename Ty>
+Var::Result<Ty> tryNumber(Var const & var)
 {
 	Var n = toNumber(var);
-	if (n)
-		return (Ty)n.n;
+	if (!n)
+		return Var::Errc::type;
+	return Var::Type::integer == n.type ? (Ty)n.i : (Ty)n.n;
+}
+
+template<typename Ty>
+Ty toNumber(Var const & var)
+{
+	auto r = tryNumber<Ty>(var);
+	if (r)
+		return r.value;
 	throw Var::TypeError(var.type, __FUNCTION__);
 }
 
 
+//限于一个线程的 Var 句柄：句柄的计数在盒子里，复制与析构不加锁、不查全局表。
+//所持的值仍是 Var，创建它、通过 get() 操作它、释放最后一个句柄时照常经过 Var::mrc 与 Var::mrcm。
+//发布版也检查所属线程：在其它线程复制或访问时抛 logic_error；在其它线程析构不抛出，
+//也不碰计数，盒子及其中的值就此泄漏。换线程须在新线程调用 adopt
+template<>
+class BasicVar<ThreadConfinedPolicy>
+{
+	struct box_t
+	{
+		Var				value;
+		std::size_t		count;
+		std::thread::id	owner;
+	};
+	box_t * _box = nullptr;
+
+	bool owned()const noexcept
+	{
+		return !_box || _box->owner == std::this_thread::get_id();
+	}
+	void check()const
+	{
+		if (!owned())
+			throw std::logic_error("Use a LocalVar outside its owning thread");
+	}
+
+public:
+	BasicVar() noexcept								{}
+	BasicVar(Var value)								: _box(new box_t{std::move(value), 1, std::this_thread::get_id()}) {}
+	BasicVar(BasicVar const & rhs)					: _box(rhs._box) { check(); if (_box) ++_box->count; }
+	BasicVar(BasicVar && rhs) noexcept				: _box(rhs._box) { rhs._box = nullptr; }
+	BasicVar & operator=(BasicVar rhs) noexcept		{ std::swap(_box, rhs._box); return *this; }
+	~BasicVar() noexcept
+	{
+		if (!_box || !owned())
+			return;
+		if (!--_box->count)
+			delete _box;
+	}
+
+	Var const & get()const							{ check(); return _box ? _box->value : Var::nil; }
+	Var const & operator*()const					{ return get(); }
+	Var const * operator->()const					{ return &get(); }
+	explicit operator bool()const					{ return (bool)get(); }
+	std::size_t useCount()const noexcept			{ return _box ? _box->count : 0; }
+
+	//在新线程调用，把值交给调用线程；还有其它引用时抛 logic_error
+	void adopt()
+	{
+		if (!_box)
+			return;
+		if (1 != _box->count)
+			throw std::logic_error("Call adopt with a shared LocalVar");
+		_box->owner = std::this_thread::get_id();
+	}
+};
+
+
 #endif
@@ -32,6 +32,41 @@ namespace util {
         --to;
         return (size + to) & ~to;
     }
+
+    inline
+    size_t HashBytes(void const * p, size_t n)
+    {
+        //FNV-1a
+        auto bytes = (unsigned char const*)p;
+        unsigned long long h = 14695981039346656037ull;
+        for( ; n; --n ) {
+            h ^= *bytes++;
+            h *= 1099511628211ull;
+        }
+        return size_t(h);
+    }
+
+    inline
+    bool HasAVX2()
+    {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+        static bool const k_has = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+        return k_has;
+#else
+        return false;
+#endif
+    }
+
+    inline
+    bool HasSSSE3()
+    {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+        static bool const k_has = (__builtin_cpu_init(), __builtin_cpu_supports("ssse3"));
+        return k_has;
+#else
+        return false;
+#endif
+    }
 }
 
 